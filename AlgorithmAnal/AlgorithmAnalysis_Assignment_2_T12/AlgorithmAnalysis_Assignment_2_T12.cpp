@@ -14,6 +14,9 @@
 #include "Utility.h"
 #include "Editor.h"
 #include "WinManager.h"
+#include "Benchmark.h"
+#include "Dispatch.h"
+#include "Profiler.h"
 
 
 #include <Windows.h>
@@ -25,8 +28,17 @@ WinManager winManager;
 
 
 
-int main()
+int main(int argc, char **argv)
 {
+	// the kernel variants are picked once, before anything is carved
+	simd::LogSelection();
+
+	// headless benchmarks, no editor or windows are created
+	if (bench::IsBenchmarkRequested(argc, argv))
+		return bench::RunBenchmarks(argc, argv);
+
+	// the stage profiler's counters only follow threads started after them, so they are opened before OpenCV starts its workers
+	prof::InitCounters();
 
 	//ShowCursor(FALSE);
 
@@ -127,6 +139,9 @@ int main()
 		{
 			imgClone = originalImg.clone();
 			brushMask = cv::Mat::zeros(originalImg.size(), CV_8UC1);
+			protectMask = cv::Mat::zeros(originalImg.size(), CV_8UC1);
+			brushSpans = util::SpanMask();
+			resetBrushOverlay();
 			cv::imshow(ORIGINAL_IMAGE, imgClone);
 		}
 		else if (key == cv::ESC_KEY)
@@ -0,0 +1,1097 @@
+/**
+ * @file Benchmark.cpp
+ * @brief Headless benchmarks of the seam carving algorithms.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#include "Benchmark.h"
+#include "SeamCarving.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+
+#if defined(_WIN32)
+#include <psapi.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace bench
+{
+
+	namespace
+	{
+		struct Options
+		{
+			std::string mode = "e2e";
+			std::string out;
+			std::string format = "csv";
+			std::vector<double> sizes = { 0.1, 0.5, 1.0, 2.0, 5.0, 12.0, 24.0, 50.0 };
+			std::vector<int> seams = { 1, 10, 50 };
+			std::vector<std::string> algos = { "greedy", "dp", "graphcut", "pyramid", "multi", "deadline", "bidir", "dp_refresh4", "dp_refresh16" };
+			int repeats = 3;
+			int warmup = 1;
+			int threads = 1;
+			int core = 0;
+			uint64_t seed = 12;
+			double graphCutMaxMp = 2.0;
+			cv::Size kernelSize = { 2000, 1500 };
+			bool useAssets = true;
+			bool useRemoval = true;
+			bool isSizesGiven = false;
+			std::vector<double> targets = { 0.9, 0.75 };
+			std::string classes;
+			int cases = 200;
+		};
+
+		const int MULTI_SEAMS_PER_PASS = 8; // seams per pass of the multi seam DP
+		const double DEADLINE_BUDGET_MS = 1000.0; // time budget of every deadline carve
+
+		struct Algorithm
+		{
+			const char *name;
+			void (*carveWidth)(cv::Mat &, int);
+			void (*carveHeight)(cv::Mat &, int);
+		};
+
+		const std::array<Algorithm, 7> algorithms =
+		{ {
+			{ "greedy", [](cv::Mat &img, int w) { VerticalSeamCarvingGreedy(img, w); }, [](cv::Mat &img, int h) { HorizontalSeamCarvingGreedy(img, h); } },
+			{ "dp", [](cv::Mat &img, int w) { VerticalSeamCarvingDP(img, w); }, [](cv::Mat &img, int h) { HorizontalSeamCarvingDP(img, h); } },
+			{ "graphcut", [](cv::Mat &img, int w) { VerticalSeamCarvingGraphCut(img, w); }, [](cv::Mat &img, int h) { HorizontalSeamCarvingGraphCut(img, h); } },
+			{ "pyramid", [](cv::Mat &img, int w) { VerticalSeamCarvingPyramid(img, w); }, [](cv::Mat &img, int h) { HorizontalSeamCarvingPyramid(img, h); } },
+			{ "multi", [](cv::Mat &img, int w) { VerticalSeamCarvingMultiDP(img, w, MULTI_SEAMS_PER_PASS); }, [](cv::Mat &img, int h) { HorizontalSeamCarvingMultiDP(img, h, MULTI_SEAMS_PER_PASS); } },
+			{ "deadline", [](cv::Mat &img, int w) { VerticalSeamCarvingDeadline(img, w, DEADLINE_BUDGET_MS); }, [](cv::Mat &img, int h) { HorizontalSeamCarvingDeadline(img, h, DEADLINE_BUDGET_MS); } },
+			{ "bidir", [](cv::Mat &img, int w) { isBidirectional = true; VerticalSeamCarvingDP(img, w); isBidirectional = false; },
+				[](cv::Mat &img, int h) { isBidirectional = true; HorizontalSeamCarvingDP(img, h); isBidirectional = false; } },
+		} };
+
+		struct RunResult
+		{
+			std::string image;
+			std::string source;
+			std::string algorithm;
+			std::string operation;
+			int width = 0;
+			int height = 0;
+			int seams = 0;
+			int repeats = 0;
+			double medianMs = 0.0;
+			double minMs = 0.0;
+			double msPerSeam = 0.0;
+			double pixelsPerSec = 0.0;
+		};
+
+		struct ScalingResult
+		{
+			std::string algorithm;
+			std::string operation;
+			int seams = 0;
+			int samples = 0;
+			double exponent = 0.0;
+		};
+
+		template <typename T>
+		std::vector<T> ParseList(const std::string &str)
+		{
+			std::vector<T> ret;
+			for (const std::string &word : util::SplitString(str, ','))
+			{
+				std::istringstream iss(util::TrimString(word));
+				T value;
+				if (iss >> value)
+					ret.push_back(value);
+			}
+			return ret;
+		}
+
+		bool ParseOptions(int argc, char **argv, Options &options)
+		{
+			int i = 1;
+			try
+			{
+				for (; i < argc; ++i)
+				{
+					std::string arg = argv[i];
+					bool hasValue = i + 1 < argc;
+
+					if (arg == "--benchmark")
+						continue;
+					else if (arg == "--no-assets")
+						options.useAssets = false;
+					else if (arg == "--no-removal")
+						options.useRemoval = false;
+					else if (!hasValue)
+					{
+						std::cerr << "Missing value for " << arg << nl;
+						return false;
+					}
+					else if (arg == "--mode")
+						options.mode = util::ToLowerCase(argv[++i]);
+					else if (arg == "--kernel-size")
+					{
+						std::string size = util::ToLowerCase(argv[++i]);
+						std::replace(size.begin(), size.end(), 'x', ',');
+						std::vector<int> dims = ParseList<int>(size);
+
+						if (dims.size() != 2 || dims[0] < 8 || dims[1] < 8)
+						{
+							std::cerr << "Kernel size must be given as WxH with both at least 8\n";
+							return false;
+						}
+						options.kernelSize = { dims[0], dims[1] };
+					}
+					else if (arg == "--out")
+						options.out = argv[++i];
+					else if (arg == "--format")
+						options.format = util::ToLowerCase(argv[++i]);
+					else if (arg == "--sizes")
+					{
+						options.sizes = ParseList<double>(argv[++i]);
+						options.isSizesGiven = true;
+					}
+					else if (arg == "--targets")
+						options.targets = ParseList<double>(argv[++i]);
+					else if (arg == "--classes")
+						options.classes = argv[++i];
+					else if (arg == "--seams")
+						options.seams = ParseList<int>(argv[++i]);
+					else if (arg == "--algos")
+						options.algos = ParseList<std::string>(argv[++i]);
+					else if (arg == "--repeats")
+						options.repeats = std::max(1, std::stoi(argv[++i]));
+					else if (arg == "--warmup")
+						options.warmup = std::max(0, std::stoi(argv[++i]));
+					else if (arg == "--threads")
+						options.threads = std::max(1, std::stoi(argv[++i]));
+					else if (arg == "--core")
+						options.core = std::stoi(argv[++i]);
+					else if (arg == "--seed")
+						options.seed = std::stoull(argv[++i]);
+					else if (arg == "--graphcut-max-mp")
+						options.graphCutMaxMp = std::stod(argv[++i]);
+					else if (arg == "--cases")
+						options.cases = std::max(1, std::stoi(argv[++i]));
+					else
+					{
+						std::cerr << "Unknown benchmark option " << arg << nl;
+						return false;
+					}
+				}
+			}
+			catch (const std::exception &)
+			{
+				// std::stoi and friends throw on a value that is not a number or does not fit
+				std::cerr << "Invalid value " << argv[i] << " for " << argv[i - 1] << nl;
+				return false;
+			}
+
+			if (options.format != "csv" && options.format != "json")
+			{
+				std::cerr << "Format must be csv or json\n";
+				return false;
+			}
+
+			if (options.mode != "e2e" && options.mode != "kernels" && options.mode != "pareto" && options.mode != "fuzz")
+			{
+				std::cerr << "Mode must be e2e, kernels, pareto or fuzz\n";
+				return false;
+			}
+
+			// every pareto case also needs a full DP reference carve, so keep the default sizes small
+			if (options.mode == "pareto" && !options.isSizesGiven)
+				options.sizes = { 0.1, 0.5 };
+
+			if (options.out.empty())
+				options.out = (options.mode == "e2e" ? std::string("bench_results") : "bench_" + options.mode) + "." + options.format;
+			return true;
+		}
+
+		double Median(std::vector<double> values)
+		{
+			std::sort(values.begin(), values.end());
+			size_t mid = values.size() / 2;
+			return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+		}
+
+		// times fn on a fresh copy of img, the copy itself is not timed
+		template <typename Fn>
+		std::vector<double> TimeRuns(const cv::Mat &img, const Options &options, Fn fn)
+		{
+			std::vector<double> times;
+			for (int i = 0; i < options.warmup + options.repeats; ++i)
+			{
+				cv::Mat work = img.clone();
+				std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+				fn(work);
+				double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+				if (i >= options.warmup)
+					times.push_back(elapsed);
+			}
+			return times;
+		}
+
+		RunResult MakeResult(const BenchImage &image, const std::string &algorithm, const std::string &operation, int seams, const std::vector<double> &times)
+		{
+			RunResult result;
+			result.image = image.name;
+			result.source = image.source;
+			result.algorithm = algorithm;
+			result.operation = operation;
+			result.width = image.img.cols;
+			result.height = image.img.rows;
+			result.seams = seams;
+			result.repeats = static_cast<int>(times.size());
+			result.medianMs = Median(times);
+			result.minMs = *std::min_element(times.begin(), times.end());
+			result.msPerSeam = seams ? result.medianMs / seams : 0.0;
+
+			// every seam touches roughly the whole image, so count the input pixels once per seam
+			double pixels = static_cast<double>(image.img.total()) * std::max(seams, 1);
+			result.pixelsPerSec = result.medianMs > 0.0 ? pixels / (result.medianMs / 1000.0) : 0.0;
+			return result;
+		}
+
+		// least squares slope of log(time) against log(pixels) over the synthetic sizes
+		std::vector<ScalingResult> FitScaling(const std::vector<RunResult> &results)
+		{
+			std::map<std::tuple<std::string, std::string, int>, std::vector<std::pair<double, double>>> groups;
+			for (const RunResult &result : results)
+				if (result.source == "synthetic" && result.medianMs > 0.0)
+					groups[{ result.algorithm, result.operation, result.seams }].push_back(
+						{ std::log(static_cast<double>(result.width) * result.height), std::log(result.medianMs) });
+
+			std::vector<ScalingResult> ret;
+			for (const auto &[key, points] : groups)
+			{
+				if (points.size() < 2)
+					continue;
+
+				double n = static_cast<double>(points.size()), sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+				for (const auto &[x, y] : points)
+				{
+					sx += x;
+					sy += y;
+					sxx += x * x;
+					sxy += x * y;
+				}
+
+				double denom = n * sxx - sx * sx;
+				if (std::abs(denom) < 1e-12)
+					continue;
+
+				ScalingResult scaling;
+				std::tie(scaling.algorithm, scaling.operation, scaling.seams) = key;
+				scaling.samples = static_cast<int>(points.size());
+				scaling.exponent = (n * sxy - sx * sy) / denom;
+				ret.push_back(scaling);
+			}
+			return ret;
+		}
+
+		// a result table with a fixed column order, cells are preformatted so output is stable between runs
+		struct Table
+		{
+			std::string name;
+			std::vector<std::pair<std::string, bool>> columns; // name, is text
+			std::vector<std::vector<std::string>> rows{};
+		};
+
+		std::string Cell(double value)
+		{
+			std::ostringstream oss;
+			oss << std::fixed << std::setprecision(4) << value;
+			return oss.str();
+		}
+
+		std::string Cell(int value)
+		{
+			return std::to_string(value);
+		}
+
+		std::string Cell(const std::string &value)
+		{
+			return value;
+		}
+
+		// the first table goes to --out, every other table to <out stem>_<table name> when writing csv
+		std::string TablePath(const std::string &out, const Table &table, bool isFirst)
+		{
+			if (isFirst)
+				return out;
+
+			std::filesystem::path path(out);
+			return (path.parent_path() / (path.stem().string() + "_" + table.name + path.extension().string())).string();
+		}
+
+		void WriteTables(const Options &options, const std::vector<Table> &tables)
+		{
+			if (options.format == "csv")
+			{
+				for (size_t t = 0; t < tables.size(); ++t)
+				{
+					const Table &table = tables[t];
+					std::ofstream ofs(TablePath(options.out, table, !t));
+
+					for (size_t c = 0; c < table.columns.size(); ++c)
+						ofs << (c ? "," : "") << table.columns[c].first;
+					ofs << nl;
+
+					for (const std::vector<std::string> &row : table.rows)
+					{
+						for (size_t c = 0; c < row.size(); ++c)
+							ofs << (c ? "," : "") << (table.columns[c].second ? util::Quote(row[c]) : row[c]);
+						ofs << nl;
+					}
+				}
+				return;
+			}
+
+			std::ofstream ofs(options.out);
+			ofs << "{\n  \"config\": { \"mode\": \"" << options.mode << "\", \"repeats\": " << options.repeats << ", \"warmup\": " << options.warmup
+				<< ", \"threads\": " << options.threads << ", \"core\": " << options.core << ", \"seed\": " << options.seed << " }";
+
+			for (const Table &table : tables)
+			{
+				ofs << ",\n  \"" << table.name << "\": [\n";
+				for (size_t r = 0; r < table.rows.size(); ++r)
+				{
+					ofs << "    { ";
+					for (size_t c = 0; c < table.columns.size(); ++c)
+						ofs << (c ? ", " : "") << '"' << table.columns[c].first << "\": " << (table.columns[c].second ? util::Quote(table.rows[r][c]) : table.rows[r][c]);
+					ofs << " }" << (r + 1 < table.rows.size() ? "," : "") << nl;
+				}
+				ofs << "  ]";
+			}
+			ofs << "\n}\n";
+		}
+
+		std::vector<BenchImage> CollectImages(const Options &options)
+		{
+			std::vector<BenchImage> images;
+			if (options.useAssets)
+				images = LoadAssetImages();
+
+			for (double mp : options.sizes)
+			{
+				std::ostringstream name;
+				name << "synthetic_" << mp << "mp";
+				images.push_back({ name.str(), "synthetic", MakeSyntheticImage(mp, options.seed) });
+			}
+			return images;
+		}
+
+		int RunEndToEnd(const Options &options)
+		{
+			std::vector<RunResult> results;
+
+			for (const BenchImage &image : CollectImages(options))
+			{
+				double mp = static_cast<double>(image.img.total()) / 1e6;
+
+				for (const Algorithm &algo : algorithms)
+				{
+					if (std::find(options.algos.begin(), options.algos.end(), algo.name) == options.algos.end())
+						continue;
+					if (std::string(algo.name) == "graphcut" && mp > options.graphCutMaxMp)
+						continue;
+
+					for (int seams : options.seams)
+					{
+						if (seams <= 0)
+							continue;
+
+						std::cerr << image.name << ' ' << algo.name << ' ' << seams << " seams\n";
+
+						// the greedy search needs a few columns on either side of the seam
+						if (seams < image.img.cols - 4)
+						{
+							int target = image.img.cols - seams;
+							results.push_back(MakeResult(image, algo.name, "carve_width", seams, TimeRuns(image.img, options, [&](cv::Mat &img) { algo.carveWidth(img, target); })));
+						}
+
+						if (seams < image.img.rows - 4)
+						{
+							int target = image.img.rows - seams;
+							results.push_back(MakeResult(image, algo.name, "carve_height", seams, TimeRuns(image.img, options, [&](cv::Mat &img) { algo.carveHeight(img, target); })));
+						}
+					}
+				}
+
+				// object removal always searches with DP
+				if (options.useRemoval)
+				{
+					std::cerr << image.name << " object removal\n";
+
+					int removed = 0;
+					std::vector<double> times = TimeRuns(image.img, options, [&](cv::Mat &img)
+						{
+							brushMask = MakeRemovalMask(img.size());
+							brushSpans = MakeSpanMask(brushMask);
+							ContentAwareRemoval(img);
+							removed = (image.img.cols - img.cols) + (image.img.rows - img.rows);
+						});
+					results.push_back(MakeResult(image, "dp", "object_removal", removed, times));
+				}
+			}
+
+			Table runs{ "runs", { { "image", true }, { "source", false }, { "algorithm", false }, { "operation", false }, { "width", false }, { "height", false },
+				{ "seams", false }, { "repeats", false }, { "median_ms", false }, { "min_ms", false }, { "ms_per_seam", false }, { "pixels_per_sec", false } } };
+			for (const RunResult &r : results)
+				runs.rows.push_back({ Cell(r.image), Cell(r.source), Cell(r.algorithm), Cell(r.operation), Cell(r.width), Cell(r.height),
+					Cell(r.seams), Cell(r.repeats), Cell(r.medianMs), Cell(r.minMs), Cell(r.msPerSeam), Cell(r.pixelsPerSec) });
+
+			Table scaling{ "scaling", { { "algorithm", false }, { "operation", false }, { "seams", false }, { "samples", false }, { "exponent", false } } };
+			for (const ScalingResult &r : FitScaling(results))
+				scaling.rows.push_back({ Cell(r.algorithm), Cell(r.operation), Cell(r.seams), Cell(r.samples), Cell(r.exponent) });
+
+			WriteTables(options, { runs, scaling });
+
+			std::cerr << "Wrote " << results.size() << " results to " << options.out << nl;
+			return 0;
+		}
+
+		// best-of-repeats bandwidth of a plain copy between two buffers that do not fit in cache
+		double MeasureCopyBandwidth(const Options &options, size_t elements)
+		{
+			std::vector<double> src(elements, 1.0), dst(elements, 0.0);
+			double best = 0.0;
+
+			for (int i = 0; i < options.warmup + std::max(options.repeats, 5); ++i)
+			{
+				std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+				for (size_t j = 0; j < elements; ++j)
+					dst[j] = src[j];
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+				// one read and one write per element, as counted by STREAM
+				if (i >= options.warmup && seconds > 0.0)
+					best = std::max(best, 2.0 * sizeof(double) * elements / seconds / 1e9);
+				src[i % elements] = dst[(i + 1) % elements]; // keep the copy observable
+			}
+			return best;
+		}
+
+		// times kernel only, setup runs untimed before every run to restore the inputs
+		template <typename Setup, typename Kernel>
+		std::vector<double> TimeKernel(const Options &options, Setup setup, Kernel kernel)
+		{
+			std::vector<double> times;
+			for (int i = 0; i < options.warmup + options.repeats; ++i)
+			{
+				setup();
+				std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+				kernel();
+				double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+				if (i >= options.warmup)
+					times.push_back(elapsed);
+			}
+			return times;
+		}
+
+		int RunKernels(const Options &options)
+		{
+			cv::Mat img = MakeSyntheticImage(options.kernelSize, options.seed);
+			double pixels = static_cast<double>(img.total());
+
+			// fixed inputs for every kernel, derived once from the synthetic image
+			std::vector<cv::Mat> channels;
+			cv::split(img, channels);
+			cv::Mat rawEnergy = CalculateEnergyMap(channels);
+			cv::Mat energy;
+			cv::normalize(rawEnergy, energy, 0, 255, cv::NORM_MINMAX);
+			cv::Mat cumVer = CalculateVerticalCumMap(energy);
+			cv::Mat cumHor = CalculateHorizontalCumMap(energy);
+			std::vector<int> seamVer = FindVerticalSeamDP(cumVer);
+			std::vector<int> seamHor = FindHorizontalSeamDP(cumHor);
+
+			Table table{ "kernels", { { "kernel", false }, { "width", false }, { "height", false }, { "bytes", false }, { "median_ms", false },
+				{ "min_ms", false }, { "gb_per_sec", false }, { "ns_per_pixel", false }, { "pct_of_copy", false } } };
+
+			// a copy of 4 bytes of input and 8 bytes of output per pixel, but at least 64 MB per buffer
+			size_t copyElements = std::max<size_t>(static_cast<size_t>(pixels) * 12 / sizeof(double), size_t(8) << 20);
+			double copyGbPerSec = MeasureCopyBandwidth(options, copyElements);
+			double copyBytes = 2.0 * sizeof(double) * copyElements;
+			table.rows.push_back({ "stream_copy", Cell(static_cast<int>(copyElements)), Cell(1), Cell(copyBytes), Cell(copyBytes / copyGbPerSec / 1e6),
+				Cell(copyBytes / copyGbPerSec / 1e6), Cell(copyGbPerSec), Cell(copyBytes / copyGbPerSec / copyElements), Cell(100.0) });
+
+			// bytes are the compulsory traffic of each kernel: its inputs read once and its outputs written once
+			auto addKernel = [&](const std::string &name, double bytes, const std::vector<double> &times)
+			{
+				double minMs = *std::min_element(times.begin(), times.end());
+				double gbPerSec = minMs > 0.0 ? bytes / (minMs / 1000.0) / 1e9 : 0.0;
+				table.rows.push_back({ name, Cell(img.cols), Cell(img.rows), Cell(bytes), Cell(Median(times)), Cell(minMs),
+					Cell(gbPerSec), Cell(minMs * 1e6 / pixels), Cell(copyGbPerSec > 0.0 ? gbPerSec / copyGbPerSec * 100.0 : 0.0) });
+			};
+			auto none = []() {};
+			cv::Mat out, work;
+			std::vector<int> seam;
+
+			std::cerr << "CalculateEnergyMap\n";
+			addKernel("CalculateEnergyMap", pixels * (3 + sizeof(double)), TimeKernel(options, none, [&]() { out = CalculateEnergyMap(channels); }));
+
+			std::cerr << "CalculateVerticalCumMap\n";
+			addKernel("CalculateVerticalCumMap", pixels * 2 * sizeof(double), TimeKernel(options, none, [&]() { out = CalculateVerticalCumMap(energy); }));
+
+			std::cerr << "CalculateVerticalCumMapTiled\n";
+			addKernel("CalculateVerticalCumMapTiled", pixels * 2 * sizeof(double), TimeKernel(options, none, [&]() { out = CalculateVerticalCumMapTiled(energy); }));
+
+			std::cerr << "CalculateHorizontalCumMap\n";
+			addKernel("CalculateHorizontalCumMap", pixels * 2 * sizeof(double), TimeKernel(options, none, [&]() { out = CalculateHorizontalCumMap(energy); }));
+
+			// the seam search reads the first row and three neighbours per row
+			std::cerr << "FindVerticalSeamDP\n";
+			addKernel("FindVerticalSeamDP", (img.cols + 3.0 * img.rows) * sizeof(double) + img.rows * sizeof(int), TimeKernel(options, none, [&]() { seam = FindVerticalSeamDP(cumVer); }));
+
+			// both halves of the cumulative map are written and read again, on the unnormalised energy it needs to be exact
+			std::cerr << "FindVerticalSeamBidirectional\n";
+			addKernel("FindVerticalSeamBidirectional", pixels * 3 * sizeof(double), TimeKernel(options, none, [&]() { seam = FindVerticalSeamBidirectional(rawEnergy); }));
+
+			// on average half of each row/column is shifted, one read and one write per shifted pixel
+			std::cerr << "RemoveVerticalSeam\n";
+			addKernel("RemoveVerticalSeam", pixels * 3, TimeKernel(options, [&]() { work = img.clone(); }, [&]() { RemoveVerticalSeam(work, seamVer); }));
+
+			std::cerr << "RemoveHorizontalSeam\n";
+			addKernel("RemoveHorizontalSeam", pixels * 3, TimeKernel(options, [&]() { work = img.clone(); }, [&]() { RemoveHorizontalSeam(work, seamHor); }));
+
+			// the image and its energy map compacted in the same pass
+			cv::Mat workEnergy;
+			std::cerr << "RemoveVerticalSeamFused\n";
+			addKernel("RemoveVerticalSeamFused", pixels * (3 + sizeof(double)), TimeKernel(options, [&]() { work = img.clone(); workEnergy = energy.clone(); }, [&]() { RemoveVerticalSeam(work, seamVer, { &workEnergy }); }));
+
+			std::cerr << "RemoveHorizontalSeamFused\n";
+			addKernel("RemoveHorizontalSeamFused", pixels * (3 + sizeof(double)), TimeKernel(options, [&]() { work = img.clone(); workEnergy = energy.clone(); }, [&]() { RemoveHorizontalSeam(work, seamHor, { &workEnergy }); }));
+
+			WriteTables(options, { table });
+			std::cerr << "Wrote " << table.rows.size() << " kernels to " << options.out << nl;
+			return 0;
+		}
+		struct Strategy
+		{
+			const char *name;
+			void (*carve)(cv::Mat &, int, CarveStats *);
+		};
+
+		// every strategy carves to the target width, the first one is the reference for the SSIM column
+		const std::vector<Strategy> strategies =
+		{
+			{ "dp", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingDP(img, w, stats); } },
+			{ "greedy", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingGreedy(img, w, stats); } },
+			{ "graphcut", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingGraphCut(img, w, stats); } },
+			{ "pyramid", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingPyramid(img, w, 2, 4, stats); } },
+			{ "multi", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingMultiDP(img, w, MULTI_SEAMS_PER_PASS, stats); } },
+			{ "deadline", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingDeadline(img, w, DEADLINE_BUDGET_MS, stats); } },
+			{ "bidir", [](cv::Mat &img, int w, CarveStats *stats) { isBidirectional = true; VerticalSeamCarvingDP(img, w, stats); isBidirectional = false; } },
+			{ "dp_refresh4", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingDP(img, w, stats, 4); } },
+			{ "dp_refresh16", [](cv::Mat &img, int w, CarveStats *stats) { VerticalSeamCarvingDP(img, w, stats, 16); } },
+		};
+
+		size_t CurrentRss()
+		{
+#if defined(_WIN32)
+			PROCESS_MEMORY_COUNTERS pmc;
+			if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+				return pmc.WorkingSetSize;
+			return 0;
+#elif defined(__linux__)
+			std::ifstream statm("/proc/self/statm");
+			size_t pages = 0, resident = 0;
+			statm >> pages >> resident;
+			return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+			return 0;
+#endif
+		}
+
+		// samples the resident set on a second thread, since the peak counters of the os cannot be reset between cases
+		class MemorySampler
+		{
+			std::atomic<bool> isRunning{ false };
+			std::atomic<size_t> peak{ 0 };
+			size_t baseline = 0;
+			std::thread sampler;
+
+		public:
+
+			void Start()
+			{
+				baseline = CurrentRss();
+				peak = baseline;
+				isRunning = true;
+				sampler = std::thread([this]()
+					{
+						while (isRunning)
+						{
+							size_t rss = CurrentRss();
+							if (rss > peak)
+								peak = rss;
+							std::this_thread::sleep_for(std::chrono::milliseconds(1));
+						}
+					});
+			}
+
+			// returns the peak growth of the resident set since Start in bytes
+			size_t Stop()
+			{
+				isRunning = false;
+				sampler.join();
+
+				size_t rss = CurrentRss();
+				if (rss > peak)
+					peak = rss;
+				return peak - baseline;
+			}
+		};
+
+		// mean SSIM over the colour channels, with the usual 11x11 gaussian window
+		double ComputeSsim(const cv::Mat &a, const cv::Mat &b)
+		{
+			if (a.size() != b.size() || a.type() != b.type())
+				return 0.0;
+
+			const double c1 = 6.5025, c2 = 58.5225;
+			cv::Mat i1, i2;
+			a.convertTo(i1, CV_32F);
+			b.convertTo(i2, CV_32F);
+
+			cv::Mat mu1, mu2, sigma1, sigma2, sigma12;
+			cv::GaussianBlur(i1, mu1, cv::Size(11, 11), 1.5);
+			cv::GaussianBlur(i2, mu2, cv::Size(11, 11), 1.5);
+			cv::Mat mu1Sq = mu1.mul(mu1), mu2Sq = mu2.mul(mu2), mu1Mu2 = mu1.mul(mu2);
+
+			cv::GaussianBlur(i1.mul(i1), sigma1, cv::Size(11, 11), 1.5);
+			cv::GaussianBlur(i2.mul(i2), sigma2, cv::Size(11, 11), 1.5);
+			cv::GaussianBlur(i1.mul(i2), sigma12, cv::Size(11, 11), 1.5);
+			sigma1 -= mu1Sq;
+			sigma2 -= mu2Sq;
+			sigma12 -= mu1Mu2;
+
+			cv::Mat num = (2 * mu1Mu2 + c1).mul(2 * sigma12 + c2);
+			cv::Mat den = (mu1Sq + mu2Sq + c1).mul(sigma1 + sigma2 + c2);
+			cv::Mat ssim;
+			cv::divide(num, den, ssim);
+
+			cv::Scalar mean = cv::mean(ssim);
+			double sum = 0.0;
+			for (int c = 0; c < a.channels(); ++c)
+				sum += mean[c];
+			return sum / a.channels();
+		}
+
+		// classes come from a "file,class" csv when given, otherwise from the source and size of the image
+		std::map<std::string, std::string> LoadClasses(const std::string &path)
+		{
+			std::map<std::string, std::string> classes;
+			std::ifstream ifs(path);
+			std::string line;
+			while (std::getline(ifs, line))
+			{
+				std::vector<std::string> words = util::SplitString(line, ',');
+				if (words.size() >= 2)
+					classes[util::TrimString(words[0])] = util::TrimString(words[1]);
+			}
+			return classes;
+		}
+
+		std::string ClassOf(const BenchImage &image, const std::map<std::string, std::string> &classes)
+		{
+			if (auto it = classes.find(image.name); it != classes.end())
+				return it->second;
+
+			double mp = static_cast<double>(image.img.total()) / 1e6;
+			return image.source + (mp < 1.0 ? "_small" : mp < 8.0 ? "_medium" : "_large");
+		}
+
+		struct QualityResult
+		{
+			std::string image;
+			std::string imageClass;
+			std::string strategy;
+			int width = 0;
+			int height = 0;
+			int targetWidth = 0;
+			double target = 0.0;
+			double ms = 0.0;
+			double peakMb = 0.0;
+			int seams = 0;
+			double removedEnergy = 0.0;
+			double energyPerPixel = 0.0;
+			double energyVsDp = 0.0;  // relative change of the removed energy against the DP carve
+			double staleDrift = 0.0;  // relative error of the seam costs on the energy maps they were found on
+			double ssim = 0.0;
+			std::string strategies;   // seams removed by every strategy of a deadline carve
+		};
+
+		int RunPareto(const Options &options)
+		{
+			std::map<std::string, std::string> classes;
+			if (!options.classes.empty())
+				classes = LoadClasses(options.classes);
+
+			std::vector<QualityResult> results;
+			for (const BenchImage &image : CollectImages(options))
+			{
+				double mp = static_cast<double>(image.img.total()) / 1e6;
+
+				for (double target : options.targets)
+				{
+					int targetWidth = static_cast<int>(std::lround(image.img.cols * target));
+					if (target <= 0.0 || target >= 1.0 || targetWidth < 8)
+						continue;
+
+					cv::Mat reference;
+					double referenceEnergy = 0.0;
+					for (const Strategy &strategy : strategies)
+					{
+						if (std::find(options.algos.begin(), options.algos.end(), strategy.name) == options.algos.end() && &strategy != &strategies.front())
+							continue;
+						if (std::string(strategy.name) == "graphcut" && mp > options.graphCutMaxMp)
+							continue;
+
+						std::cerr << image.name << ' ' << strategy.name << " to " << targetWidth << " px\n";
+
+						cv::Mat work = image.img.clone();
+						CarveStats stats;
+						MemorySampler sampler;
+
+						sampler.Start();
+						std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+						strategy.carve(work, targetWidth, &stats);
+						double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+						size_t peak = sampler.Stop();
+
+						if (reference.empty())
+						{
+							reference = work;
+							referenceEnergy = stats.removedEnergy;
+						}
+
+						QualityResult result;
+						result.image = image.name;
+						result.imageClass = ClassOf(image, classes);
+						result.strategy = strategy.name;
+						result.width = image.img.cols;
+						result.height = image.img.rows;
+						result.targetWidth = targetWidth;
+						result.target = target;
+						result.ms = ms;
+						result.peakMb = static_cast<double>(peak) / (1024.0 * 1024.0);
+						result.seams = stats.seams;
+						result.removedEnergy = stats.removedEnergy;
+						result.energyPerPixel = stats.seams ? stats.removedEnergy / (static_cast<double>(stats.seams) * image.img.rows) : 0.0;
+						result.energyVsDp = referenceEnergy > 0.0 ? stats.removedEnergy / referenceEnergy - 1.0 : 0.0;
+						result.staleDrift = stats.removedEnergy > 0.0 ? (stats.staleEnergy - stats.removedEnergy) / stats.removedEnergy : 0.0;
+						result.ssim = ComputeSsim(work, reference);
+						if (std::string(strategy.name) == "deadline")
+							result.strategies = DescribeStrategies(stats);
+						results.push_back(result);
+					}
+				}
+			}
+
+			Table quality{ "quality", { { "image", true }, { "class", true }, { "strategy", false }, { "width", false }, { "height", false },
+				{ "target_width", false }, { "ms", false }, { "peak_mb", false }, { "seams", false }, { "removed_energy", false },
+				{ "energy_per_pixel", false }, { "energy_vs_dp", false }, { "stale_drift", false }, { "ssim_vs_dp", false }, { "strategies", true } } };
+			for (const QualityResult &r : results)
+				quality.rows.push_back({ Cell(r.image), Cell(r.imageClass), Cell(r.strategy), Cell(r.width), Cell(r.height), Cell(r.targetWidth),
+					Cell(r.ms), Cell(r.peakMb), Cell(r.seams), Cell(r.removedEnergy), Cell(r.energyPerPixel), Cell(r.energyVsDp), Cell(r.staleDrift), Cell(r.ssim), Cell(r.strategies) });
+
+			// average every strategy per class and target, then mark the ones no other strategy dominates
+			struct Point
+			{
+				int images = 0;
+				double ms = 0.0, peakMb = 0.0, energyPerPixel = 0.0, ssim = 0.0;
+			};
+
+			std::map<std::tuple<std::string, double, std::string>, Point> points;
+			for (const QualityResult &r : results)
+			{
+				Point &point = points[{ r.imageClass, r.target, r.strategy }];
+				++point.images;
+				point.ms += r.ms;
+				point.peakMb += r.peakMb;
+				point.energyPerPixel += r.energyPerPixel;
+				point.ssim += r.ssim;
+			}
+
+			for (auto &[key, point] : points)
+			{
+				point.ms /= point.images;
+				point.peakMb /= point.images;
+				point.energyPerPixel /= point.images;
+				point.ssim /= point.images;
+			}
+
+			auto dominates = [](const Point &a, const Point &b)
+			{
+				bool isNoWorse = a.ms <= b.ms && a.peakMb <= b.peakMb && a.energyPerPixel <= b.energyPerPixel && a.ssim >= b.ssim;
+				bool isBetter = a.ms < b.ms || a.peakMb < b.peakMb || a.energyPerPixel < b.energyPerPixel || a.ssim > b.ssim;
+				return isNoWorse && isBetter;
+			};
+
+			Table pareto{ "pareto", { { "class", true }, { "target", false }, { "strategy", false }, { "images", false }, { "mean_ms", false },
+				{ "mean_peak_mb", false }, { "mean_energy_per_pixel", false }, { "mean_ssim_vs_dp", false }, { "on_frontier", false } } };
+			for (const auto &[key, point] : points)
+			{
+				const auto &[imageClass, target, strategy] = key;
+
+				bool isDominated = false;
+				for (const auto &[otherKey, other] : points)
+					if (std::get<0>(otherKey) == imageClass && std::get<1>(otherKey) == target && dominates(other, point))
+						isDominated = true;
+
+				pareto.rows.push_back({ Cell(imageClass), Cell(target), Cell(strategy), Cell(point.images), Cell(point.ms),
+					Cell(point.peakMb), Cell(point.energyPerPixel), Cell(point.ssim), Cell(isDominated ? 0 : 1) });
+			}
+
+			WriteTables(options, { pareto, quality });
+			std::cerr << "Wrote " << pareto.rows.size() << " pareto points to " << options.out << nl;
+			return 0;
+		}
+
+		const std::array<const char *, 4> FUZZ_CONTENTS = { "synthetic", "flat", "noise", "stripes" };
+
+		int RunFuzz(const Options &options)
+		{
+			bool wasValidating = isValidating;
+			isValidating = true;
+			int failures = 0;
+
+			for (int i = 0; i < options.cases; ++i)
+			{
+				uint64_t seed = options.seed + i;
+				cv::RNG rng(seed);
+
+				// every tenth case is wide enough for the tiled cumulative map, the rest stay small so there are many of them
+				bool isWide = i % 10 == 9;
+				cv::Size size = isWide ? cv::Size(TILED_CUM_MAP_MIN_COLS + rng.uniform(0, 64), rng.uniform(2, 12)) : cv::Size(rng.uniform(2, 97), rng.uniform(2, 97));
+
+				// flat and striped images are full of equal sums, so they exercise the tie breaking
+				int content = rng.uniform(0, static_cast<int>(FUZZ_CONTENTS.size()));
+				cv::Mat img;
+				switch (content)
+				{
+				case 0:
+					img = MakeSyntheticImage(size, seed);
+					break;
+				case 1:
+					img = cv::Mat(size, CV_8UC3, cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)));
+					break;
+				case 2:
+					img.create(size, CV_8UC3);
+					rng.fill(img, cv::RNG::UNIFORM, 0, 256);
+					break;
+				default:
+					img = cv::Mat::zeros(size, CV_8UC3);
+					for (int col = 0; col < size.width; col += 4)
+						img.colRange(col, std::min(col + 2, size.width)).setTo(cv::Scalar::all(255));
+					break;
+				}
+
+				// half of the cases carve an ROI of at least 2x2 pixels
+				cv::Rect roi;
+				if (rng.uniform(0, 2))
+				{
+					roi.x = rng.uniform(0, size.width - 1);
+					roi.y = rng.uniform(0, size.height - 1);
+					roi.width = rng.uniform(2, size.width - roi.x + 1);
+					roi.height = rng.uniform(2, size.height - roi.y + 1);
+				}
+
+				// half of the cases protect a random rectangle
+				cv::Mat bias;
+				if (rng.uniform(0, 2))
+				{
+					bias = cv::Mat::zeros(size, CV_64F);
+					cv::Point topLeft(rng.uniform(0, size.width), rng.uniform(0, size.height));
+					bias(cv::Rect(topLeft, cv::Size(rng.uniform(1, size.width + 1), rng.uniform(1, size.height + 1))) & cv::Rect(cv::Point(), size)).setTo(protection);
+				}
+
+				int refreshInterval = rng.uniform(0, 2) ? 1 : 4;
+				int bandCols = GetSeamBand(roi, size, true).size(), bandRows = GetSeamBand(roi, size, false).size();
+				int verticalSeams = rng.uniform(1, std::min(bandCols - 1, isWide ? 2 : 16) + 1);
+				int horizontalSeams = rng.uniform(1, std::min(bandRows - 1, 16) + 1);
+
+				// every odd case searches the DP seams from both ends, which is checked against the serial FindVerticalSeamDP,
+				// a protected case carves with the serial search as the bidirectional one has no bias
+				firstDivergence.reset();
+				cv::Mat work = img.clone();
+				isBidirectional = i % 2 == 1;
+				VerticalSeamCarvingDP(work, size.width - verticalSeams, nullptr, refreshInterval, bias.empty() ? nullptr : &bias, roi);
+				HorizontalSeamCarvingDP(work, size.height - horizontalSeams, nullptr, refreshInterval, bias.empty() ? nullptr : &bias, roi);
+				isBidirectional = false;
+
+				// the multi seam search carves the same number of seams, a few at a time
+				int seamsPerPass = rng.uniform(1, 9);
+				work = img.clone();
+				VerticalSeamCarvingMultiDP(work, size.width - verticalSeams, seamsPerPass);
+				HorizontalSeamCarvingMultiDP(work, size.height - horizontalSeams, seamsPerPass);
+
+				// object removal tries both directions at once, which checks the incremental energy updates of both
+				cv::Rect area = roi.empty() ? cv::Rect(cv::Point(), size) : roi;
+				cv::Rect object(area.x + rng.uniform(0, area.width), area.y + rng.uniform(0, area.height), rng.uniform(1, area.width / 2 + 2), rng.uniform(1, area.height / 2 + 2));
+				object &= area;
+				brushMask = cv::Mat::zeros(size, CV_8U);
+				brushMask(object).setTo(255);
+				brushSpans = util::SpanMask();
+				work = img.clone();
+				ContentAwareRemoval(work, nullptr, refreshInterval, true, false, roi);
+
+				if (firstDivergence)
+				{
+					++failures;
+					std::cerr << "Case " << i << " (seed " << seed << "): " << size.width << "x" << size.height << ' ' << FUZZ_CONTENTS[content]
+						<< ", " << verticalSeams << " vertical and " << horizontalSeams << " horizontal seams, roi " << roi
+						<< ", refresh " << refreshInterval << (bias.empty() ? "" : ", protected") << (i % 2 ? ", bidirectional" : "") << ", " << seamsPerPass << " seams per pass, object " << object << nl;
+				}
+			}
+
+			isValidating = wasValidating;
+			std::cerr << options.cases - failures << " of " << options.cases << " fuzz cases matched the reference backend\n";
+			return failures ? 1 : 0;
+		}
+	}
+
+	bool IsBenchmarkRequested(int argc, char **argv)
+	{
+		for (int i = 1; i < argc; ++i)
+			if (std::string(argv[i]) == "--benchmark")
+				return true;
+		return false;
+	}
+
+	int RunBenchmarks(int argc, char **argv)
+	{
+		Options options;
+		if (!ParseOptions(argc, argv, options))
+			return 1;
+
+		isHeadless = true;
+
+		// the OpenCV workers inherit the affinity of the thread that starts them, so the cores are set before the pool is sized
+		// and every thread gets a core of its own
+		if (options.core >= 0 && !PinCurrentThread(options.core, options.threads))
+			std::cerr << "Could not pin the benchmark to cores " << options.core << " to " << options.core + options.threads - 1 << nl;
+
+		cv::setNumThreads(options.threads);
+		cv::setRNGSeed(static_cast<int>(options.seed));
+
+		if (options.mode == "kernels")
+			return RunKernels(options);
+		if (options.mode == "pareto")
+			return RunPareto(options);
+		if (options.mode == "fuzz")
+			return RunFuzz(options);
+		return RunEndToEnd(options);
+	}
+
+	cv::Mat MakeSyntheticImage(double megapixels, uint64_t seed)
+	{
+		int height = std::max(8, static_cast<int>(std::lround(std::sqrt(megapixels * 1e6 / 1.5))));
+		int width = std::max(8, static_cast<int>(std::lround(height * 1.5)));
+		return MakeSyntheticImage(cv::Size(width, height), seed);
+	}
+
+	cv::Mat MakeSyntheticImage(cv::Size size, uint64_t seed)
+	{
+		int width = size.width, height = size.height;
+
+		cv::RNG rng(seed);
+		cv::Mat img(height, width, CV_8UC3);
+
+		// smooth background gradient
+		for (int i = 0; i < height; ++i)
+		{
+			cv::Vec3b *row = img.ptr<cv::Vec3b>(i);
+			for (int j = 0; j < width; ++j)
+				row[j] = cv::Vec3b(static_cast<uchar>(255 * j / width), static_cast<uchar>(255 * i / height), 128);
+		}
+
+		// flat blocks give the image some structure worth protecting
+		int blocks = 24;
+		for (int b = 0; b < blocks; ++b)
+		{
+			cv::Point topLeft(rng.uniform(0, width), rng.uniform(0, height));
+			cv::Size size(rng.uniform(width / 40 + 1, width / 6 + 2), rng.uniform(height / 40 + 1, height / 6 + 2));
+			cv::rectangle(img, cv::Rect(topLeft, size), cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)), cv::FILLED);
+		}
+
+		// low amplitude noise
+		cv::Mat noise(img.size(), CV_8UC3);
+		rng.fill(noise, cv::RNG::UNIFORM, 0, 16);
+		img += noise;
+		return img;
+	}
+
+	std::vector<BenchImage> LoadAssetImages()
+	{
+		std::vector<std::filesystem::path> paths;
+		if (std::filesystem::exists("assets/images"))
+			for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator("assets/images"))
+				if (entry.path().extension() == ".png" || entry.path().extension() == ".jpg")
+					paths.push_back(entry.path());
+		std::sort(paths.begin(), paths.end());
+
+		std::vector<BenchImage> images;
+		for (const std::filesystem::path &path : paths)
+		{
+			cv::Mat img = cv::imread(path.string(), cv::IMREAD_COLOR);
+			if (!img.empty())
+				images.push_back({ path.filename().string(), "asset", img });
+		}
+		return images;
+	}
+
+	bool PinCurrentThread(int core, int count)
+	{
+		if (core < 0 || count < 1)
+			return false;
+
+#if defined(_WIN32)
+		// an affinity mask has a bit per core
+		if (core + count > static_cast<int>(sizeof(DWORD_PTR) * 8))
+			return false;
+
+		DWORD_PTR mask = 0;
+		for (int i = core; i < core + count; ++i)
+			mask |= DWORD_PTR(1) << i;
+		return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+		if (core + count > CPU_SETSIZE)
+			return false;
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int i = core; i < core + count; ++i)
+			CPU_SET(i, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	cv::Mat MakeRemovalMask(cv::Size size)
+	{
+		cv::Mat mask = cv::Mat::zeros(size, CV_8UC1);
+		cv::ellipse(mask, cv::Point(size.width / 2, size.height / 2), cv::Size(std::max(1, size.width / 40), std::max(1, size.height / 6)), 0.0, 0.0, 360.0, cv::Scalar(255), cv::FILLED);
+		return mask;
+	}
+
+}
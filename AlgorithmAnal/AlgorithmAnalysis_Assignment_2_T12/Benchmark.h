@@ -0,0 +1,135 @@
+/**
+ * @file Benchmark.h
+ * @brief Headless benchmarks of the seam carving algorithms.
+ *
+ * Running the executable with --benchmark skips the editor and all OpenCV windows and
+ * times the carving drivers instead. The end-to-end benchmark runs Greedy, DP, Graph Cut,
+ * pyramid, multi seam DP (8 seams per pass), deadline (1 s budget) and bidirectional DP
+ * carve-to-size as well as object removal over every image in assets/images and over synthetic images of 0.1 to
+ * 50 megapixels, sweeping the number of seams removed.
+ *
+ * Runs are made comparable between builds by a warm-up pass, pinning the benchmark to one
+ * core per OpenCV thread, a fixed OpenCV thread count and a fixed seed for the synthetic images.
+ * Results are written as CSV or JSON with a fixed column order and precision so that two
+ * result files can be diffed directly.
+ *
+ * The kernel benchmark (--mode kernels) times the individual energy, cumulative map, seam
+ * search and seam removal kernels on a fixed size input and reports the bytes each kernel
+ * has to touch, the achieved GB/s and ns per pixel next to a STREAM style copy of the same
+ * machine, which shows how much headroom each kernel has left.
+ *
+ * The pareto report (--mode pareto) carves every image to each target width with every
+ * strategy and records the wall time, the peak growth of the resident set, the total energy
+ * of the removed seams and the SSIM of the result against the DP carve. Strategies are then
+ * averaged per image class and target, and the ones no other strategy beats on every one of
+ * those measures are marked as being on the Pareto frontier. The DP strategies that only
+ * refresh the energy map every 4 or 16 seams (dp_refresh4, dp_refresh16) also report how far
+ * their removed energy drifts from the DP carve and from the stale maps they carved with.
+ * The deadline strategy carves within a one second budget and lists the seams each of its
+ * fallback strategies removed.
+ *
+ * The fuzz driver (--mode fuzz) carves random small images, flat and striped ones full of ties
+ * and a few wider than TILED_CUM_MAP_MIN_COLS with the DP drivers and a random ROI, protected
+ * area and energy refresh interval, every odd case with isBidirectional set so that the seams of
+ * FindVerticalSeamBidirectional are checked against FindVerticalSeamDP, then with the multi seam DP and a random number of seams per
+ * pass, and removes a random brushed rectangle in both directions at once. isValidating is set,
+ * so every seam and every incremental energy update is checked against the reference backend.
+ * Each case prints its seed when it diverges and the exit code is 1 if any did.
+ *
+ * Usage:
+ *   AlgorithmAnalysis_Assignment_2_T12.exe --benchmark [options]
+ *
+ *   --mode <name>         e2e, kernels, pareto or fuzz (default e2e)
+ *   --out <file>          results file (default bench_results.csv, bench_kernels.csv or bench_pareto.csv)
+ *   --format <csv|json>   output format (default csv)
+ *   --sizes <mp,...>      synthetic image sizes in megapixels (default 0.1,0.5,1,2,5,12,24,50, pareto 0.1,0.5)
+ *   --seams <n,...>       seam counts to sweep (default 1,10,50)
+ *   --algos <name,...>    any of greedy,dp,graphcut,pyramid,multi,deadline,bidir,dp_refresh4,dp_refresh16 (default all)
+ *   --repeats <n>         measured runs per case (default 3)
+ *   --warmup <n>          unmeasured runs per case (default 1)
+ *   --threads <n>         OpenCV worker threads (default 1)
+ *   --core <n>            first core to pin to, the benchmark runs on cores n to n + threads - 1, -1 to disable pinning (default 0)
+ *   --seed <n>            seed for the synthetic images (default 12)
+ *   --graphcut-max-mp <n> skip graph cut above this size, it needs ~100 bytes per pixel (default 2)
+ *   --no-assets           only run the synthetic images
+ *   --no-removal          skip the object removal cases
+ *   --kernel-size <WxH>   input size of the kernel benchmark (default 2000x1500)
+ *   --targets <f,...>     pareto target widths as a fraction of the width (default 0.9,0.75)
+ *   --classes <file>      pareto image classes as "file,class" lines (default by source and size)
+ *   --cases <n>           fuzz cases, case i uses seed + i (default 200)
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+	struct BenchImage
+	{
+		std::string name;
+		std::string source; // "asset" or "synthetic"
+		cv::Mat img;
+	};
+
+	/**
+	 * @brief Checks whether the command line asks for a benchmark instead of the editor.
+	 */
+	bool IsBenchmarkRequested(int argc, char **argv);
+
+	/**
+	 * @brief Runs the benchmark selected on the command line.
+	 *
+	 * @return int The process exit code.
+	 */
+	int RunBenchmarks(int argc, char **argv);
+
+	/**
+	 * @brief Creates a deterministic BGR test image of roughly the given size with a 3:2 aspect ratio.
+	 *
+	 * The image mixes smooth gradients, flat blocks and noise so that the energy map is neither
+	 * uniform nor pure noise.
+	 *
+	 * @param megapixels The number of pixels in millions.
+	 * @param seed The seed for the random content.
+	 */
+	cv::Mat MakeSyntheticImage(double megapixels, uint64_t seed);
+
+	/**
+	 * @brief Creates a deterministic BGR test image of exactly the given size.
+	 */
+	cv::Mat MakeSyntheticImage(cv::Size size, uint64_t seed);
+
+	/**
+	 * @brief Loads every png and jpg in assets/images, sorted by file name.
+	 */
+	std::vector<BenchImage> LoadAssetImages();
+
+	/**
+	 * @brief Pins the calling thread to a range of cores so repeated runs are not migrated to other cores.
+	 *
+	 * Threads the calling thread starts afterwards inherit the affinity on Linux.
+	 *
+	 * @param core The first core index, a negative value leaves the affinity untouched.
+	 * @param count The number of consecutive cores, the range has to fit the affinity mask of the platform.
+	 * @return true If the thread was pinned.
+	 */
+	bool PinCurrentThread(int core, int count = 1);
+
+	/**
+	 * @brief Creates an elliptical removal mask in the centre of an image of the given size.
+	 */
+	cv::Mat MakeRemovalMask(cv::Size size);
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * @file CostModel.cpp
+ * @brief Runtime and memory prediction for choosing a seam carving algorithm automatically.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#include "CostModel.h"
+#include "SeamCarving.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace cost
+{
+
+	namespace
+	{
+		CostModel model;
+		bool isLoaded = false;
+
+		const std::array<const char *, edit::AUTO> algoNames =
+		{
+			"greedy",
+			"dp",
+			"graphcut"
+		};
+
+		// peak bytes per pixel: the image, its channels, the sobel gradients and the 64 bit energy maps,
+		// plus for graph cut one maxflow node (~48 bytes) and six arcs (~32 bytes each) per pixel
+		const std::array<double, edit::AUTO> bytesPerPixel =
+		{
+			64.0,
+			88.0,
+			64.0 + 48.0 + 6.0 * 32.0
+		};
+
+		void CarveWidth(edit::AlgoMode algo, cv::Mat &img, int targetWidth)
+		{
+			switch (algo)
+			{
+			case edit::GREEDY:
+				VerticalSeamCarvingGreedy(img, targetWidth);
+				break;
+
+			case edit::DYNAMIC:
+				VerticalSeamCarvingDP(img, targetWidth);
+				break;
+
+			case edit::GRAPH:
+				VerticalSeamCarvingGraphCut(img, targetWidth);
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		// number of pixels visited by all seams, vertical seams are removed first as in the editor
+		double PixelsVisited(cv::Size size, cv::Size target)
+		{
+			double rows = size.height, cols = size.width;
+			double verSeams = std::max(0, size.width - target.width);
+			double horSeams = std::max(0, size.height - target.height);
+			double width = std::min(size.width, target.width);
+
+			return rows * (verSeams * cols - verSeams * (verSeams - 1.0) / 2.0)
+				+ width * (horSeams * rows - horSeams * (horSeams - 1.0) / 2.0);
+		}
+
+		bool LoadCostModel()
+		{
+			std::ifstream ifs(COST_MODEL_FILE);
+			if (!ifs)
+				return false;
+
+			int found = 0;
+			std::string line;
+			while (std::getline(ifs, line))
+			{
+				if (line.empty() || line[0] == '#')
+					continue;
+
+				std::istringstream iss(line);
+				std::string name;
+				AlgoCost algoCost;
+				if (!(iss >> name >> algoCost.msPerPixel >> algoCost.msPerSeam))
+					continue;
+
+				for (int i = 0; i < edit::AUTO; ++i)
+					if (name == algoNames[i])
+					{
+						algoCost.bytesPerPixel = bytesPerPixel[i];
+						model.algos[i] = algoCost;
+						++found;
+					}
+			}
+
+			model.isCalibrated = found == edit::AUTO;
+			return model.isCalibrated;
+		}
+
+		void SaveCostModel()
+		{
+			std::ofstream ofs(COST_MODEL_FILE);
+			ofs << "# seam carving cost model, delete this file to recalibrate\n";
+			ofs << "# algorithm ms_per_pixel ms_per_seam\n";
+			ofs << std::scientific << std::setprecision(6);
+			for (int i = 0; i < edit::AUTO; ++i)
+				ofs << algoNames[i] << ' ' << model.algos[i].msPerPixel << ' ' << model.algos[i].msPerSeam << nl;
+		}
+	}
+
+	const CostModel &GetCostModel()
+	{
+		if (!isLoaded)
+		{
+			isLoaded = true;
+			if (!LoadCostModel())
+				CalibrateCostModel();
+		}
+		return model;
+	}
+
+	const CostModel &CalibrateCostModel()
+	{
+		const int seams = 4;
+		const std::array<double, 2> sizes = { 0.05, 0.2 };
+
+		// the calibration must not draw seams or wait on the windows
+		bool wasHeadless = isHeadless;
+		isHeadless = true;
+
+		for (int i = 0; i < edit::AUTO; ++i)
+		{
+			std::array<double, 2> pixels{}, ms{};
+			for (size_t s = 0; s < sizes.size(); ++s)
+			{
+				cv::Mat img = bench::MakeSyntheticImage(sizes[s], 12);
+				pixels[s] = PixelsVisited(img.size(), cv::Size(img.cols - seams, img.rows));
+
+				std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+				CarveWidth(static_cast<edit::AlgoMode>(i), img, img.cols - seams);
+				ms[s] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+			}
+
+			// two sizes with the same seam count give the per pixel slope and the per seam intercept
+			AlgoCost &algoCost = model.algos[i];
+			algoCost.msPerPixel = std::max(0.0, (ms[1] - ms[0]) / (pixels[1] - pixels[0]));
+			algoCost.msPerSeam = std::max(0.0, (ms[0] - algoCost.msPerPixel * pixels[0]) / seams);
+			algoCost.bytesPerPixel = bytesPerPixel[i];
+		}
+
+		isHeadless = wasHeadless;
+		model.isCalibrated = true;
+		isLoaded = true;
+		SaveCostModel();
+		return model;
+	}
+
+	Prediction Predict(edit::AlgoMode algo, cv::Size size, cv::Size target)
+	{
+		const AlgoCost &algoCost = GetCostModel().algos[algo];
+		int seams = std::max(0, size.width - target.width) + std::max(0, size.height - target.height);
+
+		Prediction prediction;
+		prediction.ms = algoCost.msPerPixel * PixelsVisited(size, target) + algoCost.msPerSeam * seams;
+		prediction.mb = algoCost.bytesPerPixel * static_cast<double>(size.area()) / (1024.0 * 1024.0);
+		return prediction;
+	}
+
+	edit::AlgoMode ChooseAlgorithm(cv::Size size, cv::Size target, double timeBudgetMs, double memoryBudgetMb)
+	{
+		// best quality first
+		const std::array<edit::AlgoMode, edit::AUTO> preference = { edit::GRAPH, edit::DYNAMIC, edit::GREEDY };
+
+		for (edit::AlgoMode algo : preference)
+		{
+			Prediction prediction = Predict(algo, size, target);
+			std::cout << "Auto: " << algoNames[algo] << " predicted " << prediction.ms << " ms, " << prediction.mb << " MB\n";
+
+			if (prediction.ms <= timeBudgetMs && prediction.mb <= memoryBudgetMb)
+				return algo;
+		}
+
+		std::cout << "Auto: nothing fits the budget, falling back to greedy\n";
+		return edit::GREEDY;
+	}
+
+}
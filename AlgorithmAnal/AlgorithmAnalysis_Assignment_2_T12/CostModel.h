@@ -0,0 +1,87 @@
+/**
+ * @file CostModel.h
+ * @brief Runtime and memory prediction for choosing a seam carving algorithm automatically.
+ *
+ * The time each algorithm spends per seam grows with the number of pixels it has to visit, so
+ * the model keeps a cost per pixel and a fixed overhead per seam for every algorithm. These are
+ * calibrated by carving two small synthetic images on the host and cached to disk so the
+ * calibration only runs once. Memory is predicted from the bytes each algorithm allocates per
+ * pixel, which is dominated by the maxflow graph for graph cut.
+ *
+ * ChooseAlgorithm picks the best quality algorithm (graph cut, then dynamic programming, then
+ * greedy) whose predicted runtime and memory fit the given budgets.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#ifndef COSTMODEL_H
+#define COSTMODEL_H
+
+#include <array>
+#include <string>
+
+#include "Editor.h"
+
+namespace cost
+{
+
+	inline const std::string COST_MODEL_FILE = "costmodel.txt";
+
+	struct AlgoCost
+	{
+		double msPerPixel = 0.0;    // time per pixel visited by one seam
+		double msPerSeam = 0.0;     // fixed overhead per seam
+		double bytesPerPixel = 0.0; // peak working memory per pixel of the input image
+	};
+
+	struct CostModel
+	{
+		std::array<AlgoCost, edit::AUTO> algos{};
+		bool isCalibrated = false;
+	};
+
+	struct Prediction
+	{
+		double ms = 0.0;
+		double mb = 0.0;
+	};
+
+	// budgets used by the auto mode, set from the seam carver panel
+	inline float timeBudgetSec = 30.f;
+	inline float memoryBudgetMb = 2048.f;
+
+	/**
+	 * @brief Gets the cost model, loading it from disk or calibrating it on first use.
+	 */
+	const CostModel &GetCostModel();
+
+	/**
+	 * @brief Runs the short calibration benchmark on this host and saves the result to disk.
+	 */
+	const CostModel &CalibrateCostModel();
+
+	/**
+	 * @brief Predicts the runtime and peak memory of carving an image to a target size.
+	 *
+	 * @param algo The algorithm to predict (any mode before AUTO).
+	 * @param size The current size of the image.
+	 * @param target The target size, vertical seams are removed first and then horizontal seams.
+	 */
+	Prediction Predict(edit::AlgoMode algo, cv::Size size, cv::Size target);
+
+	/**
+	 * @brief Chooses the best quality algorithm whose prediction fits in the budgets.
+	 *
+	 * Falls back to greedy, the cheapest algorithm, when nothing fits.
+	 *
+	 * @param size The current size of the image.
+	 * @param target The target size.
+	 * @param timeBudgetMs The time budget in milliseconds.
+	 * @param memoryBudgetMb The memory budget in megabytes.
+	 */
+	edit::AlgoMode ChooseAlgorithm(cv::Size size, cv::Size target, double timeBudgetMs, double memoryBudgetMb);
+
+}
+
+#endif
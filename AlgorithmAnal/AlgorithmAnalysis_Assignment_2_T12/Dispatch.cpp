@@ -0,0 +1,281 @@
+/**
+ * @file Dispatch.cpp
+ * @brief Runtime selection of the instruction set the carving kernels run with.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#include "Dispatch.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DISPATCH_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// msvc compiles intrinsics of any level into a baseline build, gcc and clang need every function marked with its level
+#if defined(_MSC_VER) || !defined(DISPATCH_X64)
+#define DISPATCH_TARGET(isa)
+#else
+#define DISPATCH_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace simd
+{
+
+	namespace
+	{
+		// the sum of a single column, also used for the two edge columns that lack a neighbour
+		inline double CumElement(const double *below, const double *energy, const double *bias, int j, int cols)
+		{
+			double leftVal = j ? below[j - 1] : MAX;
+			double midVal = below[j];
+			double rightVal = j < cols - 1 ? below[j + 1] : MAX;
+			double minVal = std::min({ leftVal, midVal, rightVal });
+			return (bias ? energy[j] + bias[j] : energy[j]) + minVal;
+		}
+
+		// the columns from start to the end of the row, and column 0 which the vector loops skip
+		inline double CumRemainder(const double *below, const double *energy, const double *bias, double *curr, int start, int cols, double max)
+		{
+			for (int j = start; j < cols; ++j)
+			{
+				curr[j] = CumElement(below, energy, bias, j, cols);
+				max = curr[j] > max ? curr[j] : max;
+			}
+
+			if (start > 0 && cols)
+			{
+				curr[0] = CumElement(below, energy, bias, 0, cols);
+				max = curr[0] > max ? curr[0] : max;
+			}
+			return max;
+		}
+
+		double CumRowScalar(const double *below, const double *energy, const double *bias, double *curr, int cols, double max)
+		{
+			return CumRemainder(below, energy, bias, curr, 0, cols, max);
+		}
+
+#if defined(DISPATCH_X64)
+		// the vector loops cover the columns from 1 that have both neighbours, the energy and bias are added before the minimum like the scalar sum
+		DISPATCH_TARGET("sse4.1")
+		double CumRowSse41(const double *below, const double *energy, const double *bias, double *curr, int cols, double max)
+		{
+			__m128d maxes = _mm_set1_pd(max);
+			int j = 1;
+
+			for (; j + 2 < cols; j += 2)
+			{
+				__m128d minVal = _mm_min_pd(_mm_min_pd(_mm_loadu_pd(below + j - 1), _mm_loadu_pd(below + j)), _mm_loadu_pd(below + j + 1));
+				__m128d sum = _mm_loadu_pd(energy + j);
+				if (bias)
+					sum = _mm_add_pd(sum, _mm_loadu_pd(bias + j));
+				sum = _mm_add_pd(sum, minVal);
+
+				_mm_storeu_pd(curr + j, sum);
+				maxes = _mm_max_pd(maxes, sum);
+			}
+
+			alignas(16) double lanes[2];
+			_mm_store_pd(lanes, maxes);
+			return CumRemainder(below, energy, bias, curr, j, cols, std::max(lanes[0], lanes[1]));
+		}
+
+		DISPATCH_TARGET("avx2")
+		double CumRowAvx2(const double *below, const double *energy, const double *bias, double *curr, int cols, double max)
+		{
+			__m256d maxes = _mm256_set1_pd(max);
+			int j = 1;
+
+			for (; j + 4 < cols; j += 4)
+			{
+				__m256d minVal = _mm256_min_pd(_mm256_min_pd(_mm256_loadu_pd(below + j - 1), _mm256_loadu_pd(below + j)), _mm256_loadu_pd(below + j + 1));
+				__m256d sum = _mm256_loadu_pd(energy + j);
+				if (bias)
+					sum = _mm256_add_pd(sum, _mm256_loadu_pd(bias + j));
+				sum = _mm256_add_pd(sum, minVal);
+
+				_mm256_storeu_pd(curr + j, sum);
+				maxes = _mm256_max_pd(maxes, sum);
+			}
+
+			alignas(32) double lanes[4];
+			_mm256_store_pd(lanes, maxes);
+			return CumRemainder(below, energy, bias, curr, j, cols, *std::max_element(lanes, lanes + 4));
+		}
+
+		DISPATCH_TARGET("avx512f")
+		double CumRowAvx512(const double *below, const double *energy, const double *bias, double *curr, int cols, double max)
+		{
+			__m512d maxes = _mm512_set1_pd(max);
+			int j = 1;
+
+			for (; j + 8 < cols; j += 8)
+			{
+				__m512d minVal = _mm512_min_pd(_mm512_min_pd(_mm512_loadu_pd(below + j - 1), _mm512_loadu_pd(below + j)), _mm512_loadu_pd(below + j + 1));
+				__m512d sum = _mm512_loadu_pd(energy + j);
+				if (bias)
+					sum = _mm512_add_pd(sum, _mm512_loadu_pd(bias + j));
+				sum = _mm512_add_pd(sum, minVal);
+
+				_mm512_storeu_pd(curr + j, sum);
+				maxes = _mm512_max_pd(maxes, sum);
+			}
+
+			alignas(64) double lanes[8];
+			_mm512_store_pd(lanes, maxes);
+			return CumRemainder(below, energy, bias, curr, j, cols, *std::max_element(lanes, lanes + 8));
+		}
+
+		void Cpuid(int leaf, int subleaf, int regs[4])
+		{
+#if defined(_MSC_VER)
+			__cpuidex(regs, leaf, subleaf);
+#else
+			unsigned int a = 0, b = 0, c = 0, d = 0;
+			__cpuid_count(leaf, subleaf, a, b, c, d);
+			regs[0] = static_cast<int>(a), regs[1] = static_cast<int>(b), regs[2] = static_cast<int>(c), regs[3] = static_cast<int>(d);
+#endif
+		}
+
+		// the register state the operating system saves on a context switch
+		unsigned long long Xgetbv()
+		{
+#if defined(_MSC_VER)
+			return _xgetbv(0);
+#else
+			unsigned int eax = 0, edx = 0;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+		}
+#endif
+
+		const std::array<CumRowKernel, MAX_ISA> cumRowKernels =
+		{
+			CumRowScalar,
+#if defined(DISPATCH_X64)
+			CumRowSse41,
+			CumRowAvx2,
+			CumRowAvx512
+#else
+			CumRowScalar,
+			CumRowScalar,
+			CumRowScalar
+#endif
+		};
+
+		std::string ReadIsaOverride()
+		{
+#if defined(_MSC_VER)
+			char *value = nullptr;
+			size_t length = 0;
+			if (_dupenv_s(&value, &length, ISA_ENV) || !value)
+				return "";
+			std::string env = value;
+			std::free(value);
+			return util::ToLowerCase(util::TrimString(env));
+#else
+			const char *value = std::getenv(ISA_ENV);
+			return value ? util::ToLowerCase(util::TrimString(value)) : "";
+#endif
+		}
+
+		IsaLevel SelectIsa()
+		{
+			IsaLevel detected = DetectIsa();
+			std::string env = ReadIsaOverride();
+			if (env.empty())
+				return detected;
+
+			auto it = std::find_if(ISA_NAMES.begin(), ISA_NAMES.end(), [&](const char *name) { return env == name; });
+			if (it == ISA_NAMES.end())
+			{
+				std::cerr << ISA_ENV << "=" << env << " is not one of scalar, sse4, avx2 or avx512, using " << ISA_NAMES[detected] << nl;
+				return detected;
+			}
+
+			IsaLevel requested = static_cast<IsaLevel>(it - ISA_NAMES.begin());
+			if (requested > detected)
+			{
+				std::cerr << ISA_ENV << "=" << env << " is not supported by this host, using " << ISA_NAMES[detected] << nl;
+				return detected;
+			}
+
+			// the scalar level is for comparing against plain code, so the OpenCV kernels drop their vector paths too
+			if (requested == SCALAR)
+				cv::setUseOptimized(false);
+			return requested;
+		}
+	}
+
+	IsaLevel DetectIsa()
+	{
+#if defined(DISPATCH_X64)
+		int regs[4] = {};
+		Cpuid(0, 0, regs);
+		int maxLeaf = regs[0];
+
+		Cpuid(1, 0, regs);
+		bool hasSse41 = regs[2] & (1 << 19);
+		bool hasOsxsave = regs[2] & (1 << 27);
+		bool hasAvx = regs[2] & (1 << 28);
+		if (!hasSse41)
+			return SCALAR;
+
+		// the ymm and zmm registers are only usable when the operating system saves them
+		unsigned long long xcr0 = hasOsxsave ? Xgetbv() : 0;
+		bool isYmmSaved = (xcr0 & 0x6) == 0x6;
+		bool isZmmSaved = (xcr0 & 0xe6) == 0xe6;
+
+		bool hasAvx2 = false, hasAvx512 = false;
+		if (maxLeaf >= 7)
+		{
+			Cpuid(7, 0, regs);
+			hasAvx2 = regs[1] & (1 << 5);
+			hasAvx512 = regs[1] & (1 << 16);
+		}
+
+		if (hasAvx && hasAvx512 && isZmmSaved)
+			return AVX512;
+		if (hasAvx && hasAvx2 && isYmmSaved)
+			return AVX2;
+		return SSE41;
+#else
+		return SCALAR;
+#endif
+	}
+
+	IsaLevel GetIsa()
+	{
+		static const IsaLevel isa = SelectIsa();
+		return isa;
+	}
+
+	CumRowKernel GetCumRowKernel()
+	{
+		static const CumRowKernel kernel = cumRowKernels[GetIsa()];
+		return kernel;
+	}
+
+	void LogSelection(std::ostream &os)
+	{
+		IsaLevel isa = GetIsa();
+		os << "CPU dispatch: detected " << ISA_NAMES[DetectIsa()] << ", selected " << ISA_NAMES[isa]
+			<< " (cumulative maps " << ISA_NAMES[isa]
+			<< ", energy map and transpose OpenCV " << (cv::useOptimized() ? cv::getCPUFeaturesLine() : std::string("unoptimised"))
+			<< ", seam removal memmove)" << nl;
+	}
+
+}
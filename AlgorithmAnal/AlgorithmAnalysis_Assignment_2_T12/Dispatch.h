@@ -0,0 +1,93 @@
+/**
+ * @file Dispatch.h
+ * @brief Runtime selection of the instruction set the carving kernels run with.
+ *
+ * The project is built for the baseline x64 instruction set so one binary runs on every host.
+ * The row kernel of the cumulative maps is compiled once per instruction set level (SSE4.1,
+ * AVX2 and AVX-512) next to the scalar version, and the best level the CPU and the operating
+ * system support is picked once, from CPUID, the first time a kernel is needed. The vertical
+ * map runs it on every row and the tiled one on every row of a tile's halo, the horizontal
+ * map runs the vertical one on the transposed energy.
+ * Every variant adds and compares the same values in the same order, so they produce the
+ * same cumulative map bit for bit.
+ *
+ * The energy map (cv::Sobel), transposes (cv::transpose) and seam removal (memmove) already
+ * dispatch at runtime inside OpenCV and the C runtime, the log line reports what they use.
+ *
+ * The level can be lowered for testing with the SEAM_CARVING_ISA environment variable, set to
+ * scalar, sse4, avx2 or avx512. A level the host does not support falls back to the detected
+ * one, and scalar also turns off the optimised code paths of OpenCV.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <array>
+#include <iostream>
+
+namespace simd
+{
+
+	enum IsaLevel
+	{
+		SCALAR,
+		SSE41,
+		AVX2,
+		AVX512,
+		MAX_ISA
+	};
+
+	inline const std::array<const char *, MAX_ISA> ISA_NAMES =
+	{
+		"scalar",
+		"sse4",
+		"avx2",
+		"avx512"
+	};
+
+	inline const char *ISA_ENV = "SEAM_CARVING_ISA";
+
+	/**
+	 * @brief Sums one row of the vertical cumulative map from the row below it.
+	 *
+	 * curr[j] = energy[j] + bias[j] + min(below[j - 1], below[j], below[j + 1]), where the
+	 * neighbours outside the row are ignored.
+	 *
+	 * @param below The finished row below.
+	 * @param energy The energy of the row.
+	 * @param bias The bias of the row, null for none.
+	 * @param curr The row to fill.
+	 * @param cols The number of columns.
+	 * @param max The largest sum so far.
+	 * @return double The larger of max and every sum of the row.
+	 */
+	using CumRowKernel = double (*)(const double *below, const double *energy, const double *bias, double *curr, int cols, double max);
+
+	/**
+	 * @brief Gets the best instruction set level the CPU and the operating system support.
+	 */
+	IsaLevel DetectIsa();
+
+	/**
+	 * @brief Gets the level the kernels run with, detected and read from SEAM_CARVING_ISA on the first call.
+	 */
+	IsaLevel GetIsa();
+
+	/**
+	 * @brief Gets the cumulative map row kernel of the selected level.
+	 */
+	CumRowKernel GetCumRowKernel();
+
+	/**
+	 * @brief Prints the detected and selected levels and the variant every kernel runs with.
+	 *
+	 * @param os The stream to print to.
+	 */
+	void LogSelection(std::ostream &os = std::cout);
+
+}
+
+#endif
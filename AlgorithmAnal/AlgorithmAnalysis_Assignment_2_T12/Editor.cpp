@@ -10,6 +10,8 @@
 #include "Editor.h"
 #include "SeamCarving.h"
 #include "WinManager.h"
+#include "Profiler.h"
+#include "CostModel.h"
 
 #include <filesystem>
 
@@ -353,11 +355,22 @@ namespace edit
 		ImGui::RadioButton("Carve to Size", &carveSelected, CARVE_TO_SIZE);
 		AddSpace(1);
 
-		if (carveSelected != CARVE_TO_SIZE)
+		// the target size is shared with the optimal order mode
+		if (carveSelected == OBJECT_REMOVAL)
 			ImGui::BeginDisabled();
 
-		ImGui::SliderInt("Target Width", &width, 2, cols, "%d", ImGuiSliderFlags_AlwaysClamp);
-		ImGui::SliderInt("Target Height", &height, 2, rows, "%d", ImGuiSliderFlags_AlwaysClamp);
+		// above the current size the image is enlarged by seam insertion
+		ImGui::SliderInt("Target Width", &width, 2, cols * 2, "%d", ImGuiSliderFlags_AlwaysClamp);
+		ImGui::SliderInt("Target Height", &height, 2, rows * 2, "%d", ImGuiSliderFlags_AlwaysClamp);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Sizes above the current size are reached by duplicating the lowest energy seams.");
+
+		if (carveSelected == OBJECT_REMOVAL)
+			ImGui::EndDisabled();
+
+		if (carveSelected != CARVE_TO_SIZE)
+			ImGui::BeginDisabled();
 
 		if (ImGui::BeginCombo("Algorithm", modes[modeSelected]))
 		{
@@ -368,6 +381,47 @@ namespace edit
 			ImGui::EndCombo();
 		}
 
+		if (modeSelected == DYNAMIC)
+		{
+			ImGui::SliderInt("Seams per Pass", &seamsPerPass, 1, 64, "%d", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+			ImGui::SameLine();
+			StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+			ImGui::SetItemTooltip("Remove this many non-overlapping seams per energy map. Larger values are faster on big reductions but lower quality.");
+
+			// only the single seam driver searches from both ends
+			if (seamsPerPass > 1)
+				ImGui::BeginDisabled();
+
+			ImGui::Checkbox("Bidirectional", &isBidirectional);
+			ImGui::SameLine();
+			StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+			ImGui::SetItemTooltip("Find every seam from the top and bottom half of the image at once on two threads. The seams are the same as without it, protected areas always use the plain search.");
+
+			if (seamsPerPass > 1)
+				ImGui::EndDisabled();
+		}
+
+		if (modeSelected == AUTO)
+		{
+			ImGui::SliderFloat("Time Budget", &cost::timeBudgetSec, 0.1f, 600.f, "%.1f s", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Memory Budget", &cost::memoryBudgetMb, 64.f, 65536.f, "%.0f MB", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+			ImGui::SameLine();
+			StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+			ImGui::SetItemTooltip("Auto picks the best quality algorithm whose predicted time and memory fit these budgets.");
+
+			if (ImGui::Button("Recalibrate"))
+				cost::CalibrateCostModel();
+			ImGui::SetItemTooltip("Rerun the short benchmark the predictions are based on.");
+		}
+
+		if (modeSelected == DEADLINE)
+		{
+			ImGui::SliderFloat("Deadline", &deadlineSec, 0.05f, 600.f, "%.2f s", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+			ImGui::SameLine();
+			StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+			ImGui::SetItemTooltip("Carve with dynamic programming and switch to stale energy, a downscaled seam search or a plain resize when falling behind, so the carve returns within this time. The strategies used are printed to the console.");
+		}
+
 		if (carveSelected != CARVE_TO_SIZE)
 			ImGui::EndDisabled();
 
@@ -388,17 +442,91 @@ namespace edit
 		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
 		ImGui::SetItemTooltip("The larger this value, the more the algorithm prioritises on removing the area.");
 
+		ImGui::Checkbox("Try Both Directions", &isRemovalSpeculative);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Remove the area with vertical and horizontal seams at the same time on separate threads and keep the one that needed fewer seams. The seams are not shown while both run.");
+
+		ImGui::Checkbox("Restore Size", &shldRestoreSize);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Insert as many low energy seams as were removed afterwards, so the image keeps its original size.");
+
 		if (carveSelected != OBJECT_REMOVAL)
 			ImGui::EndDisabled();
 
+		AddSpace(2);
+		ImGui::RadioButton("Optimal Order", &carveSelected, OPTIMAL_ORDER);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Carve to the target size above, interleaving vertical and horizontal seams in the order that removes the least energy.");
+		AddSpace(1);
+
+		if (carveSelected != OPTIMAL_ORDER)
+			ImGui::BeginDisabled();
+
+		ImGui::Checkbox("Approximate", &isOrderApproximate);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Decide the order on a downscaled copy of the image. The exact order carves an image for every pair of seam counts and is very slow on large reductions. It keeps an image per vertical seam, so above 1 GB of them it is decided on the largest downscaled copy that fits as well.");
+
+		if (carveSelected != OPTIMAL_ORDER)
+			ImGui::EndDisabled();
+
 		AddSpace(2);
 		ImGui::Separator();
 		AddSpace(2);
 
+		ImGui::Checkbox("Restrict to ROI", &isRoiRestricted);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Only carve inside the region below with dynamic programming and object removal. Vertical seams stay within its columns and horizontal seams within its rows, the rest of the image is kept exactly.");
+
+		if (!isRoiRestricted)
+			ImGui::BeginDisabled();
+
+		ImGui::InputInt4("ROI (x, y, w, h)", roi);
+
+		if (!isRoiRestricted)
+			ImGui::EndDisabled();
+
+		ImGui::Checkbox("Protect Brush", &isProtecting);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Paint areas the seams should avoid, in green, instead of areas to remove.");
+
+		// only the single seam dynamic programming drivers and object removal add the protection, auto when it picks them
+		bool isProtectionUsed = carveSelected == OBJECT_REMOVAL || (carveSelected == CARVE_TO_SIZE && ((modeSelected == DYNAMIC && seamsPerPass <= 1) || modeSelected == AUTO));
+		if (!isProtectionUsed)
+			ImGui::BeginDisabled();
+
+		ImGui::SliderFloat("Protection", &protection, 0.f, 500000.f, "%.2f", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Energy added to protected areas, on the same scale as a pixel's energy of at most 6120. The larger this value, the more the seams go around them. Only dynamic programming with 1 seam per pass and object removal honour it, Auto only when it picks dynamic programming.");
+
+		if (!isProtectionUsed)
+			ImGui::EndDisabled();
+
 		ImGui::SliderInt("Delay per Seam", &waitFor, 1, 1000, "%d", ImGuiSliderFlags_AlwaysClamp);
 		ImGui::SameLine();
 		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
 		ImGui::SetItemTooltip("Adjust the amount of time taken per seam carve in ms.");
+
+		ImGui::SliderInt("Energy Refresh", &refreshInterval, 1, 32, "%d", ImGuiSliderFlags_AlwaysClamp);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Recalculate the energy map every this many seams for dynamic programming and object removal. 1 is exact, larger values make dynamic programming faster but the seams drift.");
+
+		ImGui::Checkbox("Validate Kernels", &isValidating);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Check every dynamic programming seam against the plain reference kernels and print the first place they differ to the console. Very slow.");
+
+		ImGui::Checkbox("Profile Stages", &prof::isProfiling);
+		ImGui::SameLine();
+		StyleWrap(ImGuiCol_Text, LIGHT_BLUE, IconWrap(ImGui::Text(ICON_FA_INFO_CIRCLE);))
+		ImGui::SetItemTooltip("Print the time, IPC and cache/branch misses per pixel of every carving stage to the console. Hardware counters are only available on Linux.");
 		AddSpace(1);
 
 		if (!editor.GetWindow<ImageLoader>()->isFileLoaded)
@@ -412,10 +540,38 @@ namespace edit
 		{
 			allSeams = imgClone.clone();
 
+			// auto calibrates on its first carve, which is done here so the calibration runs are not profiled as part of the carve
+			if (carveSelected == CARVE_TO_SIZE && modeSelected == AUTO)
+				cost::GetCostModel();
+
+			if (prof::isProfiling)
+			{
+				prof::InitCounters();
+				prof::ResetStages();
+			}
+
+			firstDivergence.reset();
+			cv::Rect roiRect = isRoiRestricted ? cv::Rect(roi[0], roi[1], roi[2], roi[3]) : cv::Rect();
+
 			switch (carveSelected)
 			{
 			case CARVE_TO_SIZE:
-				switch (modeSelected)
+			{
+				// enlarge first, so the shrinking algorithms only see the dimensions that still have to shrink
+				if (width > imgClone.cols)
+					VerticalSeamInsertion(imgClone, width);
+				if (height > imgClone.rows)
+					HorizontalSeamInsertion(imgClone, height);
+
+				// the seams removed from here on are drawn over the enlarged image
+				if (allSeams.size() != imgClone.size())
+					allSeams = imgClone.clone();
+
+				size_t algoSelected = modeSelected;
+				if (modeSelected == AUTO)
+					algoSelected = cost::ChooseAlgorithm(imgClone.size(), cv::Size(width, height), cost::timeBudgetSec * 1000.0, cost::memoryBudgetMb);
+
+				switch (algoSelected)
 				{
 				case GREEDY:
 					VerticalSeamCarvingGreedy(imgClone, width);
@@ -423,22 +579,60 @@ namespace edit
 					break;
 
 				case DYNAMIC:
-					VerticalSeamCarvingDP(imgClone, width);
-					HorizontalSeamCarvingDP(imgClone, height);
+					if (seamsPerPass > 1 && modeSelected == DYNAMIC)
+					{
+						VerticalSeamCarvingMultiDP(imgClone, width, seamsPerPass);
+						HorizontalSeamCarvingMultiDP(imgClone, height, seamsPerPass);
+					}
+					else
+					{
+						// the protected area is shrunk along with the image, so the horizontal seams still see it
+						cv::Mat biasMap = MakeProtectBiasMap(imgClone.size());
+						VerticalSeamCarvingDP(imgClone, width, nullptr, refreshInterval, &biasMap, roiRect);
+						HorizontalSeamCarvingDP(imgClone, height, nullptr, refreshInterval, &biasMap, roiRect);
+					}
 					break;
 
 				case GRAPH:
 					VerticalSeamCarvingGraphCut(imgClone, width);
 					HorizontalSeamCarvingGraphCut(imgClone, height);
 					break;
+
+				case DEADLINE:
+				{
+					// the budget is split by seam count, the horizontal carve also gets whatever the vertical one left over
+					int verticalSeams = std::max(imgClone.cols - width, 0), horizontalSeams = std::max(imgClone.rows - height, 0);
+					double budgetMs = deadlineSec * 1000.0;
+					CarveStats stats;
+
+					if (verticalSeams)
+						VerticalSeamCarvingDeadline(imgClone, width, budgetMs * verticalSeams / (verticalSeams + horizontalSeams), &stats);
+					if (horizontalSeams)
+						HorizontalSeamCarvingDeadline(imgClone, height, budgetMs - stats.elapsedMs, &stats);
+
+					std::cout << "Deadline carve took " << stats.elapsedMs << " of " << budgetMs << " ms: " << DescribeStrategies(stats) << nl;
+					break;
+				}
 				}
 				break;
+			}
 
 			case OBJECT_REMOVAL:
-				ContentAwareRemoval(imgClone);
+				ContentAwareRemoval(imgClone, nullptr, refreshInterval, isRemovalSpeculative, shldRestoreSize, roiRect);
+				break;
+
+			case OPTIMAL_ORDER:
+				SeamCarvingOptimalOrder(imgClone, width, height, isOrderApproximate ? APPROX_ORDER_MEGAPIXELS : 0.0);
 				break;
 			}
 
+			// the drivers carve in their own buffer, the result is only shown once it is copied back
+			if (!isHeadless)
+				cv::imshow(CARVED_IMAGE, imgClone);
+
+			if (prof::isProfiling)
+				prof::ReportStages(std::cout, carveSelected == CARVE_TO_SIZE ? std::string("Carve to size (") + modes[modeSelected] + ")" : carveModes[carveSelected]);
+
 			maskInitialized = false;
 			rows = imgClone.rows;
 			cols = imgClone.cols;
@@ -693,11 +887,58 @@ namespace edit
 
 }
 
+namespace
+{
+	// the original image with the painted masks on top, only the area around every dab is redrawn
+	cv::Mat brushOverlay;
+	const uchar *overlaySource = nullptr;
+
+	// the last dab of the current stroke, the next one is joined to it
+	cv::Point lastDab(-1, -1);
+
+	// mouse moves arrive much faster than the screen refreshes, so the overlay is only shown once per frame
+	const std::chrono::milliseconds BRUSH_FRAME(16);
+	std::chrono::steady_clock::time_point lastShown;
+	bool isOverlayPending = false;
+
+	void RedrawBrushOverlay(const cv::Mat &img, cv::Rect rect)
+	{
+		cv::Mat overlay = brushOverlay(rect);
+		img(rect).copyTo(overlay);
+		overlay.setTo(cv::Scalar(0, 0, 255), brushMask(rect));
+		overlay.setTo(cv::Scalar(0, 255, 0), protectMask(rect));
+	}
+}
+
+void resetBrushOverlay()
+{
+	brushOverlay = cv::Mat();
+	overlaySource = nullptr;
+	lastDab = cv::Point(-1, -1);
+}
+
+void showBrushOverlay(bool shldForce)
+{
+	if (brushOverlay.empty() || !isOverlayPending)
+		return;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (!shldForce && now - lastShown < BRUSH_FRAME)
+		return;
+
+	cv::imshow(ORIGINAL_IMAGE, brushOverlay);
+	lastShown = now;
+	isOverlayPending = false;
+}
+
 void initializeBrushMask(const cv::Mat& img)
 {
 	if (!maskInitialized)
 	{
 		brushMask = cv::Mat::zeros(img.size(), CV_8UC1);
+		protectMask = cv::Mat::zeros(img.size(), CV_8UC1);
+		brushSpans = util::SpanMask();
+		resetBrushOverlay();
 		maskInitialized = true;
 	}
 }
@@ -709,13 +950,58 @@ void drawBrush(cv::Mat& img, cv::Point point)
 		cv::Mat newMask;
 		cv::resize(brushMask, newMask, img.size(), 0, 0, cv::INTER_NEAREST);
 		brushMask = newMask;
+		brushSpans = MakeSpanMask(brushMask);
+		resetBrushOverlay();
+	}
+
+	if (protectMask.size() != img.size())
+	{
+		cv::Mat newMask;
+		if (!protectMask.empty())
+			cv::resize(protectMask, newMask, img.size(), 0, 0, cv::INTER_NEAREST);
+		protectMask = newMask.empty() ? cv::Mat::zeros(img.size(), CV_8UC1) : newMask;
+		resetBrushOverlay();
+	}
+
+	// a fast stroke skips pixels between mouse moves, so dabs are stamped along the segment from the last one
+	cv::Point from = lastDab.x < 0 ? point : lastDab;
+	double length = cv::norm(point - from);
+	int steps = std::max(1, static_cast<int>(std::ceil(length / std::max(1, brushSize / 2))));
+
+	for (int i = lastDab.x < 0 ? 0 : 1; i <= steps; ++i)
+	{
+		cv::Point dab = from + (point - from) * (static_cast<double>(i) / steps);
+
+		if (isProtecting)
+			cv::circle(protectMask, dab, brushSize, cv::Scalar(255), -1);
+		else
+		{
+			cv::circle(brushMask, dab, brushSize, cv::Scalar(255), -1);
+			AddBrushStroke(brushSpans, brushMask.size(), dab, brushSize);
+		}
+	}
+
+	lastDab = point;
+
+	// the whole overlay is only composed again when the image or the masks were replaced
+	if (brushOverlay.size() != img.size() || overlaySource != img.data)
+	{
+		brushOverlay.create(img.size(), img.type());
+		overlaySource = img.data;
+		RedrawBrushOverlay(img, cv::Rect(0, 0, img.cols, img.rows));
+	}
+	else
+	{
+		cv::Rect dirty = cv::Rect(from, point) + cv::Size(1, 1);
+		dirty = cv::Rect(dirty.x - brushSize - 1, dirty.y - brushSize - 1, dirty.width + 2 * brushSize + 2, dirty.height + 2 * brushSize + 2);
+		dirty &= cv::Rect(0, 0, img.cols, img.rows);
+
+		if (!dirty.empty())
+			RedrawBrushOverlay(img, dirty);
 	}
 
-	cv::circle(brushMask, point, brushSize, cv::Scalar(255), -1);
-	cv::Mat displayImg = img.clone();
-	displayImg.setTo(cv::Scalar(0, 0, 255), brushMask);
-	cv::addWeighted(displayImg, 1.0, img, 0.0, 0, displayImg);
-	cv::imshow(ORIGINAL_IMAGE, displayImg);
+	isOverlayPending = true;
+	showBrushOverlay(false);
 }
 
 void mouseCallback(int event, int x, int y, int flags, void* data)
@@ -723,7 +1009,12 @@ void mouseCallback(int event, int x, int y, int flags, void* data)
 	cv::Mat* img = (cv::Mat*)data;
 
 	if (brushMask.size() != img->size())
+	{
 		brushMask = cv::Mat::zeros(img->size(), CV_8UC1);
+		protectMask = cv::Mat::zeros(img->size(), CV_8UC1);
+		brushSpans = util::SpanMask();
+		resetBrushOverlay();
+	}
 
 	switch (event)
 	{
@@ -735,17 +1026,22 @@ void mouseCallback(int event, int x, int y, int flags, void* data)
 			editor.GetWindow<edit::ImageLoader>()->ReloadImage();
 		}
 
+		// a new stroke is not joined to the end of the last one
 		isDrawing = true;
+		lastDab = cv::Point(-1, -1);
 		drawBrush(*img, cv::Point(x, y));
 		break;
 
 	case cv::EVENT_MOUSEMOVE:
 		if (isDrawing)
 			drawBrush(*img, cv::Point(x, y));
+		else
+			showBrushOverlay();
 		break;
 
 	case cv::EVENT_LBUTTONUP:
 		isDrawing = false;
+		showBrushOverlay(true);
 		break;
 
 	}
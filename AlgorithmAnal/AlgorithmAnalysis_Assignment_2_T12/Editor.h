@@ -1,3 +1,4 @@
+#pragma once
 #include <string>
 #include <unordered_map>
 #include <memory>
@@ -17,6 +18,7 @@ namespace edit
 	{
 		CARVE_TO_SIZE,
 		OBJECT_REMOVAL,
+		OPTIMAL_ORDER,
 		MAX_CARVE
 	};
 
@@ -25,6 +27,8 @@ namespace edit
 		GREEDY,
 		DYNAMIC,
 		GRAPH,
+		AUTO,
+		DEADLINE,
 		MAX_ALGO
 	};
 
@@ -91,12 +95,29 @@ namespace edit
 	class SeamCarver : public EditorWindow
 	{
 		int width = 2, height = 2;
+		int seamsPerPass = 1; // seams removed per dynamic programming pass
+		int refreshInterval = 1; // seams between energy map recalculations for dynamic programming and object removal
+		bool isOrderApproximate = true; // fill the transport map on a downscaled image
+		bool isRemovalSpeculative = false; // remove objects in both directions at once and keep the better one
+		bool shldRestoreSize = false; // insert the removed number of seams back after object removal
+		bool isRoiRestricted = false; // confine dynamic programming and object removal seams to the roi
+		int roi[4] = { 0, 0, 0, 0 }; // x, y, width and height of the region seams may cross
+		float deadlineSec = 1.f; // time budget of the deadline mode
+
+		const std::array<const char *, MAX_CARVE> carveModes =
+		{
+			"Carve to size",
+			"Object removal",
+			"Optimal order"
+		};
 
 		const std::array<const char *, MAX_ALGO> modes =
 		{
 			"Greedy",
 			"Dynamic programming",
-			"Graph cut"
+			"Graph cut",
+			"Auto",
+			"Deadline"
 		};
 
 	public:
@@ -171,5 +192,7 @@ namespace edit
 }
 
 void initializeBrushMask(const cv::Mat& img);
+void resetBrushOverlay(); // call whenever brushMask or protectMask is replaced outside the brush
+void showBrushOverlay(bool shldForce = false); // shows the painted masks if they changed, at most once per frame unless forced
 void drawBrush(cv::Mat& img, cv::Point point);
 void mouseCallback(int event, int x, int y, int flags, void* data);
\ No newline at end of file
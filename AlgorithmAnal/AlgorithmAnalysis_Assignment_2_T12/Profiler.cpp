@@ -0,0 +1,221 @@
+/**
+ * @file Profiler.cpp
+ * @brief Per-stage profiling of the seam carving pipeline.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#include "Profiler.h"
+
+#include <iomanip>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace prof
+{
+
+	namespace
+	{
+		std::array<StageStats, MAX_STAGE> stages;
+		std::array<std::chrono::steady_clock::time_point, MAX_STAGE> stageStart;
+		std::array<std::array<uint64_t, MAX_COUNTER>, MAX_STAGE> counterStart{};
+		std::array<int, MAX_COUNTER> fds = { -1, -1, -1, -1 };
+		bool isInitialized = false;
+
+		const std::array<const char *, MAX_STAGE> stageNames =
+		{
+			"Energy map",
+			"Cumulative map",
+			"Find seam",
+			"Remove seam"
+		};
+
+#if defined(__linux__)
+		int OpenCounter(uint32_t type, uint64_t config)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+			attr.exclude_hv = 1;
+
+			// the OpenCV workers the stages run on are counted too, but only the ones started after the counter was opened
+			attr.inherit = 1;
+
+			// how long the counter was actually on the PMU, when there are more counters than registers they take turns
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			// measure this thread and its children, on any cpu
+			int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+			if (fd < 0)
+				return -1;
+
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			return fd;
+		}
+#endif
+
+		void ReadCounters(std::array<uint64_t, MAX_COUNTER> &values)
+		{
+			values.fill(0);
+#if defined(__linux__)
+			for (int i = 0; i < MAX_COUNTER; ++i)
+			{
+				// laid out as requested by read_format
+				struct
+				{
+					uint64_t value;
+					uint64_t timeEnabled;
+					uint64_t timeRunning;
+				} reading = {};
+
+				if (fds[i] < 0 || read(fds[i], &reading, sizeof(reading)) != sizeof(reading) || !reading.timeRunning)
+					continue;
+
+				// a multiplexed counter only saw part of the time, so its count is extrapolated to the whole of it
+				values[i] = reading.timeRunning < reading.timeEnabled ?
+					static_cast<uint64_t>(static_cast<double>(reading.value) * reading.timeEnabled / reading.timeRunning) : reading.value;
+			}
+#endif
+		}
+	}
+
+	bool InitCounters()
+	{
+		if (isInitialized)
+			return IsCounterAvailable(CYCLES) || IsCounterAvailable(INSTRUCTIONS) || IsCounterAvailable(LLC_MISSES) || IsCounterAvailable(BRANCH_MISSES);
+		isInitialized = true;
+
+#if defined(__linux__)
+		fds[CYCLES] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		fds[INSTRUCTIONS] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fds[LLC_MISSES] = OpenCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+		fds[BRANCH_MISSES] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+		// some virtual PMUs expose the generic cache miss event but not the LL cache event
+		if (fds[LLC_MISSES] < 0)
+			fds[LLC_MISSES] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+
+		bool isAnyAvailable = false;
+		for (int fd : fds)
+			isAnyAvailable = isAnyAvailable || fd >= 0;
+
+		if (!isAnyAvailable)
+			std::cerr << "Hardware counters are unavailable, only wall clock time will be profiled\n";
+		return isAnyAvailable;
+	}
+
+	void ShutdownCounters()
+	{
+#if defined(__linux__)
+		for (int &fd : fds)
+			if (fd >= 0)
+			{
+				close(fd);
+				fd = -1;
+			}
+#endif
+		isInitialized = false;
+	}
+
+	bool IsCounterAvailable(Counter counter)
+	{
+		return fds[counter] >= 0;
+	}
+
+	void BeginStage(Stage stage)
+	{
+		if (!isProfiling)
+			return;
+
+		ReadCounters(counterStart[stage]);
+		stageStart[stage] = std::chrono::steady_clock::now();
+	}
+
+	void EndStage(Stage stage, uint64_t pixels)
+	{
+		if (!isProfiling)
+			return;
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		std::array<uint64_t, MAX_COUNTER> counterEnd;
+		ReadCounters(counterEnd);
+
+		StageStats &stats = stages[stage];
+		stats.ms += std::chrono::duration<double, std::milli>(end - stageStart[stage]).count();
+		stats.pixels += pixels;
+		++stats.calls;
+
+		for (int i = 0; i < MAX_COUNTER; ++i)
+			stats.counters[i] += counterEnd[i] - counterStart[stage][i];
+	}
+
+	void ResetStages()
+	{
+		stages = {};
+	}
+
+	const StageStats &GetStage(Stage stage)
+	{
+		return stages[stage];
+	}
+
+	void ReportStages(std::ostream &os, const std::string &label)
+	{
+		bool hasIpc = IsCounterAvailable(CYCLES) && IsCounterAvailable(INSTRUCTIONS);
+
+		os << label << ":\n";
+		os << std::left << std::setw(16) << "Stage" << std::right
+			<< std::setw(8) << "Calls"
+			<< std::setw(12) << "ms"
+			<< std::setw(12) << "ns/px"
+			<< std::setw(8) << "IPC"
+			<< std::setw(14) << "LLC miss/px"
+			<< std::setw(14) << "Br miss/px" << '\n';
+
+		for (int i = 0; i < MAX_STAGE; ++i)
+		{
+			const StageStats &stats = stages[i];
+			if (!stats.calls)
+				continue;
+
+			double pixels = stats.pixels ? static_cast<double>(stats.pixels) : 1.0;
+			os << std::left << std::setw(16) << stageNames[i] << std::right << std::fixed
+				<< std::setw(8) << stats.calls
+				<< std::setw(12) << std::setprecision(2) << stats.ms
+				<< std::setw(12) << std::setprecision(3) << stats.ms * 1e6 / pixels;
+
+			if (hasIpc && stats.counters[CYCLES])
+				os << std::setw(8) << std::setprecision(2) << static_cast<double>(stats.counters[INSTRUCTIONS]) / static_cast<double>(stats.counters[CYCLES]);
+			else
+				os << std::setw(8) << "-";
+
+			if (IsCounterAvailable(LLC_MISSES))
+				os << std::setw(14) << std::setprecision(4) << static_cast<double>(stats.counters[LLC_MISSES]) / pixels;
+			else
+				os << std::setw(14) << "-";
+
+			if (IsCounterAvailable(BRANCH_MISSES))
+				os << std::setw(14) << std::setprecision(4) << static_cast<double>(stats.counters[BRANCH_MISSES]) / pixels;
+			else
+				os << std::setw(14) << "-";
+
+			os << '\n';
+		}
+
+		os << std::defaultfloat;
+	}
+
+}
@@ -0,0 +1,117 @@
+/**
+ * @file Profiler.h
+ * @brief Per-stage profiling of the seam carving pipeline.
+ *
+ * The carving drivers are split into four stages (energy map, cumulative map, seam search
+ * and seam removal). Each stage is timed with a wall clock and, on Linux, with hardware
+ * performance counters opened through perf_event_open (cycles, instructions, last level
+ * cache misses and branch misses). The accumulated results are reported as ms, IPC and
+ * misses per pixel for every stage.
+ *
+ * The counters are inherited by the threads the process starts after they were opened, which
+ * covers the OpenCV worker threads as long as InitCounters is called before OpenCV starts them,
+ * and are scaled up for the time they were multiplexed off the PMU.
+ *
+ * When the counters cannot be opened (other platforms, containers, VMs or a restrictive
+ * perf_event_paranoid) only the wall clock columns are reported.
+ *
+ * Author: Team 12
+ * Date: 21/11/2024
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace prof
+{
+
+	enum Stage
+	{
+		ENERGY,
+		CUM_MAP,
+		FIND_SEAM,
+		REMOVE_SEAM,
+		MAX_STAGE
+	};
+
+	enum Counter
+	{
+		CYCLES,
+		INSTRUCTIONS,
+		LLC_MISSES,
+		BRANCH_MISSES,
+		MAX_COUNTER
+	};
+
+	struct StageStats
+	{
+		double ms = 0.0;
+		uint64_t pixels = 0;
+		uint64_t calls = 0;
+		std::array<uint64_t, MAX_COUNTER> counters{};
+	};
+
+	// set from the seam carver panel, stages are not measured while this is false
+	inline bool isProfiling = false;
+
+	/**
+	 * @brief Opens the hardware counters. Safe to call more than once.
+	 *
+	 * Only the calling thread and the threads started after the first call are counted.
+	 *
+	 * @return true If at least one hardware counter could be opened.
+	 */
+	bool InitCounters();
+
+	/**
+	 * @brief Closes any hardware counters opened by InitCounters.
+	 */
+	void ShutdownCounters();
+
+	/**
+	 * @brief Checks whether a specific hardware counter is being measured.
+	 */
+	bool IsCounterAvailable(Counter counter);
+
+	/**
+	 * @brief Marks the start of a pipeline stage.
+	 *
+	 * @param stage The stage that is about to run.
+	 */
+	void BeginStage(Stage stage);
+
+	/**
+	 * @brief Marks the end of a pipeline stage and accumulates its measurements.
+	 *
+	 * @param stage The stage that just finished (must match the last BeginStage).
+	 * @param pixels The number of pixels the stage processed, used for the per pixel columns.
+	 */
+	void EndStage(Stage stage, uint64_t pixels);
+
+	/**
+	 * @brief Clears all accumulated stage measurements.
+	 */
+	void ResetStages();
+
+	/**
+	 * @brief Gets the accumulated measurements of a stage.
+	 */
+	const StageStats &GetStage(Stage stage);
+
+	/**
+	 * @brief Prints a table of the accumulated stage measurements.
+	 *
+	 * @param os The stream to print to.
+	 * @param label A heading printed above the table.
+	 */
+	void ReportStages(std::ostream &os = std::cout, const std::string &label = "Stage profile");
+
+}
+
+#endif
@@ -29,10 +29,17 @@
 #include "Utility.h"
 #include "Editor.h"
 #include "WinManager.h"
+#include "Profiler.h"
+#include "Dispatch.h"
 
 #include <vector>
 #include <iomanip>
+#include <cstring>
 #include <iostream>
+#include <numeric>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include "graph.cpp"
 
 // maxflow graph (for cut graph)
@@ -42,258 +49,606 @@ extern edit::Editor editor;
 extern WinManager winManager;
 
 // =============
-// OBJECT REMOVAL
+// CARVE BUFFER
 // =============
 
-std::vector<util::Mask> GetBoundedArea(cv::Point2i start, cv::Point2i end)
+CarveBuffer::CarveBuffer(const cv::Mat &img) : storage(img.isContinuous() ? img : img.clone()), width(img.cols), height(img.rows)
 {
-	std::vector<util::Mask> ret;
-	for (int i = start.y; i < end.y; ++i)
-		ret.push_back({ start.x, end.x - start.x, i }); // idk why emplace_back got error
-	return ret;
 }
 
-bool ModifyMask(std::vector<util::Mask> &area, const std::vector<int> &seam)
+cv::Mat CarveBuffer::View() const
 {
-	bool isMaskGone = true;
+	return storage(cv::Rect(0, 0, width, height));
+}
 
-	for (util::Mask &slice : area)
-	{
-		int currSeam = seam[slice.pos];
+size_t CarveBuffer::Stride() const
+{
+	return storage.step;
+}
 
-		if (currSeam < slice.start)
-			--slice.start;
-		else if (currSeam >= slice.start && currSeam < slice.start + slice.size)
-			--slice.size;
+void CarveBuffer::RemoveVerticalSeam(std::vector<int> const &seam, std::vector<cv::Mat *> const &planes)
+{
+	cv::Mat view = View();
+	std::vector<cv::Mat *> all = { &view };
+	all.insert(all.end(), planes.begin(), planes.end());
+	RemoveVerticalSeamFromPlanes(all, seam);
+	--width;
+}
 
-		// mask is gone when all slices have a size of THRESHOLD or less
-		if (slice.size > threshold)
-			isMaskGone = false;
-	}
+void CarveBuffer::RemoveHorizontalSeam(std::vector<int> const &seam, std::vector<cv::Mat *> const &planes)
+{
+	cv::Mat view = View();
+	std::vector<cv::Mat *> all = { &view };
+	all.insert(all.end(), planes.begin(), planes.end());
+	RemoveHorizontalSeamFromPlanes(all, seam);
+	--height;
+}
 
-	// Remove empty masks
-	area.erase(std::remove_if(area.begin(), area.end(), [](const util::Mask &m) { return m.size <= 0; }), area.end());
-	return isMaskGone;
+void CarveBuffer::RemoveVerticalSeams(std::vector<std::vector<int>> const &seams)
+{
+	cv::Mat view = View();
+	::RemoveVerticalSeams(view, seams);
+	width = view.cols;
 }
 
-void ModifyVerticalEnergyMap(cv::Mat &energyMap, const std::vector<util::Mask> &area, double setTo)
+cv::Mat CarveBuffer::Compact() const
 {
-	for (const util::Mask &slice : area)
-		for (int curr = slice.start; curr < slice.start + slice.size; ++curr)
-			energyMap.at<double>(slice.pos, curr) = setTo;
+	// nothing was removed, the storage already is the image
+	if (width == storage.cols && height == storage.rows)
+		return storage;
+	return View().clone();
 }
 
-void ModifyHorizontalEnergyMap(cv::Mat& energyMap, const std::vector<util::Mask>& area, double setTo)
+cv::Range GetSeamBand(const cv::Rect &roi, cv::Size size, bool isVertical)
 {
-	for (const util::Mask& slice : area)
-		for (int curr = slice.start; curr < slice.start + slice.size; ++curr)
-			energyMap.at<double>(curr, slice.pos) = setTo;
+	int length = isVertical ? size.width : size.height;
+	if (roi.empty())
+		return cv::Range(0, length);
+
+	int start = isVertical ? roi.x : roi.y;
+	int end = start + (isVertical ? roi.width : roi.height);
+	return cv::Range(std::clamp(start, 0, length), std::clamp(end, 0, length));
 }
 
+// =============
+// OBJECT REMOVAL
+// =============
 
-void ContentAwareRemoval(cv::Mat &img)
+void AddSpan(std::vector<util::Span> &line, int start, int size)
 {
-	if (brushMask.empty() || cv::countNonZero(brushMask) == 0)
+	if (size <= 0)
 		return;
 
-#if 0
-	// Create two temporary images and masks for testing both directions
-	cv::Mat imgVertical = img.clone();
-	cv::Mat imgHorizontal = img.clone();
-	cv::Mat maskVertical = brushMask.clone();
-	cv::Mat maskHorizontal = brushMask.clone();
+	// every span that overlaps or touches the new one is merged into it
+	int end = start + size;
+	auto first = std::find_if(line.begin(), line.end(), [start](const util::Span &span) { return span.start + span.size >= start; });
+	auto last = first;
+	for (; last != line.end() && last->start <= end; ++last)
+	{
+		start = std::min(start, last->start);
+		end = std::max(end, last->start + last->size);
+	}
+
+	first = line.erase(first, last);
+	line.insert(first, { start, end - start });
+}
+
+void AddBrushStroke(util::SpanMask &spans, cv::Size size, cv::Point centre, int radius)
+{
+	spans.rows.resize(size.height);
+	spans.cols.resize(size.width);
 
-	// Count seams needed for vertical removal
-	int verticalSeams = 0;
+	// half the width of the circle on every row, it is the same on every column
+	for (int offset = -radius; offset <= radius; ++offset)
 	{
-		std::vector<util::Mask> toRemove;
-		for (int y = 0; y < maskVertical.rows; ++y)
-		{
-			int start = -1;
-			int end = -1;
+		int half = static_cast<int>(std::sqrt(static_cast<double>(radius * radius - offset * offset)));
+
+		int row = centre.y + offset;
+		int startCol = std::max(0, centre.x - half), endCol = std::min(size.width - 1, centre.x + half);
+		if (row >= 0 && row < size.height && startCol <= endCol)
+			AddSpan(spans.rows[row], startCol, endCol - startCol + 1);
+
+		int col = centre.x + offset;
+		int startRow = std::max(0, centre.y - half), endRow = std::min(size.height - 1, centre.y + half);
+		if (col >= 0 && col < size.width && startRow <= endRow)
+			AddSpan(spans.cols[col], startRow, endRow - startRow + 1);
+	}
+}
+
+util::SpanMask MakeSpanMask(const cv::Mat &mask)
+{
+	util::SpanMask spans;
+	spans.rows.resize(mask.rows);
+	spans.cols.resize(mask.cols);
+
+	// the column runs are tracked while the rows are scanned, so the mask is only read once and in order
+	std::vector<int> colStarts(mask.cols, -1);
+	for (int row{}; row < mask.rows; ++row)
+	{
+		const uchar *line = mask.ptr<uchar>(row);
+		int rowStart = -1;
 
-			uchar *row = maskVertical.ptr<uchar>(y);
-			for (int x = 0; x < maskVertical.cols; ++x)
+		for (int col{}; col < mask.cols; ++col)
+		{
+			if (line[col])
 			{
-				if (row[x] > 0)
-				{
-					if (start == -1) start = x;
-					end = x;
-				}
+				rowStart = rowStart < 0 ? col : rowStart;
+				colStarts[col] = colStarts[col] < 0 ? row : colStarts[col];
+				continue;
 			}
 
-			if (start != -1 && end != -1)
-				toRemove.push_back({ start, end - start + 1, y });
+			if (rowStart >= 0)
+				spans.rows[row].push_back({ rowStart, col - rowStart });
+			if (colStarts[col] >= 0)
+				spans.cols[col].push_back({ colStarts[col], row - colStarts[col] });
+			rowStart = colStarts[col] = -1;
 		}
 
-		while (!toRemove.empty())
-		{
-			std::vector<cv::Mat> channels;
-			cv::split(imgVertical, channels);
-			cv::Mat energyMap = CalculateEnergyMap(channels);
-			ModifyVerticalEnergyMap(energyMap, toRemove, -min);
+		if (rowStart >= 0)
+			spans.rows[row].push_back({ rowStart, mask.cols - rowStart });
+	}
 
-			cv::Mat cumMap = CalculateVerticalCumMap(energyMap);
-			std::vector<int> seam = FindVerticalSeamDP(cumMap);
+	for (int col{}; col < mask.cols; ++col)
+		if (colStarts[col] >= 0)
+			spans.cols[col].push_back({ colStarts[col], mask.rows - colStarts[col] });
 
-			//VisualizeVerticalSeam(img, seam, cv::Vec3b(0, 0, 255));
-			RemoveVerticalSeam(imgVertical, seam);
-			verticalSeams++;
+	return spans;
+}
 
-			if (ModifyMask(toRemove, seam))
-				break;
+bool ModifyMask(std::vector<std::vector<util::Span>> &lines, const std::vector<int> &seam)
+{
+	bool isMaskGone = true;
+
+	for (size_t i{}; i < lines.size(); ++i)
+	{
+		std::vector<util::Span> &line = lines[i];
+		int currSeam = seam[i];
+		bool hasEmptySpan = false;
+
+		for (util::Span &span : line)
+		{
+			if (currSeam < span.start)
+				--span.start;
+			else if (currSeam < span.start + span.size)
+				hasEmptySpan |= --span.size <= 0;
+
+			// mask is gone when all spans have a size of THRESHOLD or less
+			if (span.size > threshold)
+				isMaskGone = false;
 		}
+
+		// only the line that lost a span is compacted
+		if (hasEmptySpan)
+			line.erase(std::remove_if(line.begin(), line.end(), [](const util::Span &span) { return span.size <= 0; }), line.end());
 	}
 
-	// Count seams needed for horizontal removal
-	int horizontalSeams = 0;
+	return isMaskGone;
+}
+
+cv::Mat GetProtectMask(cv::Size size)
+{
+	if (protectMask.empty() || cv::countNonZero(protectMask) == 0)
+		return cv::Mat();
+
+	// the image was enlarged after the mask was painted, the mask is stretched with it
+	cv::Mat mask = protectMask;
+	if (mask.size() != size)
+		cv::resize(protectMask, mask, size, 0, 0, cv::INTER_NEAREST);
+	return mask;
+}
+
+cv::Mat MakeProtectBiasMap(cv::Size size)
+{
+	cv::Mat mask = GetProtectMask(size);
+	if (mask.empty())
+		return cv::Mat();
+
+	cv::Mat biasMap = cv::Mat::zeros(size, CV_64F);
+	biasMap.setTo(protection, mask);
+	return biasMap;
+}
+
+cv::Mat MakeRemovalBiasMap(cv::Size size)
+{
+	// the bias outweighs the energy of any pixel, so textured parts of the object are not carved around
+	cv::Mat biasMap = cv::Mat::zeros(size, CV_64F);
+	biasMap.setTo(-(MAX_PIXEL_ENERGY + min), brushMask);
+
+	cv::Mat mask = GetProtectMask(size);
+	if (!mask.empty())
+		biasMap.setTo(protection, mask);
+	return biasMap;
+}
+
+bool RemoveObjectVertical(cv::Mat &img, cv::Mat &biasMap, std::vector<std::vector<util::Span>> &rows, CarveStats *stats, int refreshInterval, std::atomic<int> *bestSeams, cv::Mat *finalEnergyMap,
+	const cv::Rect &roi)
+{
+	// the seams and the energy map only cover the band of the ROI, the spans are relative to it
+	cv::Range band = GetSeamBand(roi, img.size(), true);
+
+	// brushed pixels are biased instead of overwriting their energy, so the energy map never has to be recalculated
+	prof::BeginStage(prof::ENERGY);
+	std::vector<cv::Mat> channels;
+	cv::split(img.colRange(band), channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+	cv::Mat energyMap = CalculateEnergyMap(channels);
+	prof::EndStage(prof::ENERGY, energyMap.total());
+
+	CarveBuffer buffer(img);
+	bool isMaskGone = false, isStale = false;
+	int seams = 0;
+
+	while (!isMaskGone && band.size() > 1)
 	{
-		std::vector<util::Mask> toRemove;
-		for (int x = 0; x < maskHorizontal.cols; ++x)
-		{
-			int start = -1;
-			int end = -1;
+		// the other direction already removed the object with no more seams than this one has used
+		if (bestSeams && seams >= bestSeams->load())
+			return false;
 
-			for (int y = 0; y < maskHorizontal.rows; ++y)
-			{
-				if (maskHorizontal.at<uchar>(y, x) > 0)
-				{
-					if (start == -1) start = y;
-					end = y;
-				}
-			}
+		cv::Mat view = buffer.View();
 
-			if (start != -1 && end != -1)
-				toRemove.push_back({ start, end - start + 1, x });
-		}
+		prof::BeginStage(prof::CUM_MAP);
+		cv::Mat cumMap = CalculateVerticalCumMap(energyMap, biasMap.colRange(band));
+		prof::EndStage(prof::CUM_MAP, energyMap.total());
+
+		prof::BeginStage(prof::FIND_SEAM);
+		std::vector<int> seam = FindVerticalSeamDP(cumMap);
+		prof::EndStage(prof::FIND_SEAM, energyMap.total());
 
-		while (!toRemove.empty())
+		if (stats)
 		{
-			std::vector<cv::Mat> channels;
-			cv::split(imgHorizontal, channels);
-			cv::Mat energyMap = CalculateEnergyMap(channels);
-			ModifyHorizontalEnergyMap(energyMap, toRemove, -min);
+			// only the bias steers the seam, the energy map is exact unless it is stale in between refreshes
+			double seamEnergy = SumVerticalSeam(energyMap, seam);
+			++stats->seams;
+			stats->staleEnergy += seamEnergy;
+			stats->removedEnergy += isStale ? CalculateVerticalSeamEnergy(view.colRange(band), seam) : seamEnergy;
+		}
 
-			cv::Mat cumMap = CalculateHorizontalCumMap(energyMap);
-			std::vector<int> seam = FindHorizontalSeamDP(cumMap);
+		// the seam is relative to the band, the image and the bias map remove it offset by the start of the band
+		std::vector<int> imgSeam(seam);
+		for (int &col : imgSeam)
+			col += band.start;
+
+		VisualizeVerticalSeam(view, imgSeam, cv::Vec3b(0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveVerticalSeam(imgSeam, { &biasMap });
+		RemoveVerticalSeamFromMap(energyMap, seam);
+		--band.end;
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+
+		// the pixels next to the seam are recalculated, or with a refresh interval the whole band every that many seams
+		prof::BeginStage(prof::ENERGY);
+		cv::Mat bandView = buffer.View().colRange(band);
+		isStale = refreshInterval > 1 && (seams + 1) % refreshInterval != 0;
+		if (refreshInterval <= 1)
+			UpdateVerticalEnergyMap(bandView, energyMap, seam);
+		else if (!isStale)
+		{
+			cv::split(bandView, channels);
+			energyMap = CalculateEnergyMap(channels);
+		}
+		prof::EndStage(prof::ENERGY, refreshInterval <= 1 ? static_cast<uint64_t>(view.rows) * 4 : isStale ? 0 : bandView.total());
 
-			// VisualizeHorizontalSeam(img, seam, cv::Vec3b(0, 0, 255));
-			RemoveHorizontalSeam(imgHorizontal, seam);
-			horizontalSeams++;
+		if (isValidating && !isStale)
+			ValidateEnergyUpdate(bandView, energyMap, seam, seams, true);
 
-			if (ModifyMask(toRemove, seam))
-				break;
-		}
+		isMaskGone = ModifyMask(rows, seam);
+		++seams;
 	}
-#endif
 
-	std::vector<util::Mask> toRemove;
-	for (int y = 0; y < brushMask.rows; ++y)
+	img = buffer.Compact();
+	if (finalEnergyMap && !isStale)
+		*finalEnergyMap = energyMap;
+
+	if (bestSeams)
+		for (int best = bestSeams->load(); seams < best && !bestSeams->compare_exchange_weak(best, seams);)
+			;
+	return true;
+}
+
+bool RemoveObjectHorizontal(cv::Mat &img, cv::Mat &biasMap, std::vector<std::vector<util::Span>> &cols, CarveStats *stats, int refreshInterval, std::atomic<int> *bestSeams, cv::Mat *finalEnergyMap,
+	const cv::Rect &roi)
+{
+	// the seams and the energy map only cover the band of the ROI, the spans are relative to it
+	cv::Range band = GetSeamBand(roi, img.size(), false);
+
+	// brushed pixels are biased instead of overwriting their energy, so the energy map never has to be recalculated
+	prof::BeginStage(prof::ENERGY);
+	std::vector<cv::Mat> channels;
+	cv::split(img.rowRange(band), channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+	cv::Mat energyMap = CalculateEnergyMap(channels);
+	prof::EndStage(prof::ENERGY, energyMap.total());
+
+	CarveBuffer buffer(img);
+	bool isMaskGone = false, isStale = false;
+	int seams = 0;
+
+	while (!isMaskGone && band.size() > 1)
 	{
-		int start = -1;
-		int end = -1;
+		// the other direction already removed the object with no more seams than this one has used
+		if (bestSeams && seams >= bestSeams->load())
+			return false;
+
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::CUM_MAP);
+		cv::Mat cumMap = CalculateHorizontalCumMap(energyMap, biasMap.rowRange(band));
+		prof::EndStage(prof::CUM_MAP, energyMap.total());
+
+		prof::BeginStage(prof::FIND_SEAM);
+		std::vector<int> seam = FindHorizontalSeamDP(cumMap);
+		prof::EndStage(prof::FIND_SEAM, energyMap.total());
 
-		uchar* row = brushMask.ptr<uchar>(y);
-		for (int x = 0; x < brushMask.cols; ++x)
+		if (stats)
 		{
-			if (row[x] > 0)
-			{
-				if (start == -1) start = x;
-				end = x;
-			}
+			// only the bias steers the seam, the energy map is exact unless it is stale in between refreshes
+			double seamEnergy = SumHorizontalSeam(energyMap, seam);
+			++stats->seams;
+			stats->staleEnergy += seamEnergy;
+			stats->removedEnergy += isStale ? CalculateHorizontalSeamEnergy(view.rowRange(band), seam) : seamEnergy;
+		}
+
+		// the seam is relative to the band, the image and the bias map remove it offset by the start of the band
+		std::vector<int> imgSeam(seam);
+		for (int &row : imgSeam)
+			row += band.start;
+
+		VisualizeHorizontalSeam(view, imgSeam, cv::Vec3b(0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveHorizontalSeam(imgSeam, { &biasMap });
+		RemoveHorizontalSeamFromMap(energyMap, seam);
+		--band.end;
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+
+		// the pixels next to the seam are recalculated, or with a refresh interval the whole band every that many seams
+		prof::BeginStage(prof::ENERGY);
+		cv::Mat bandView = buffer.View().rowRange(band);
+		isStale = refreshInterval > 1 && (seams + 1) % refreshInterval != 0;
+		if (refreshInterval <= 1)
+			UpdateHorizontalEnergyMap(bandView, energyMap, seam);
+		else if (!isStale)
+		{
+			cv::split(bandView, channels);
+			energyMap = CalculateEnergyMap(channels);
 		}
+		prof::EndStage(prof::ENERGY, refreshInterval <= 1 ? static_cast<uint64_t>(view.cols) * 4 : isStale ? 0 : bandView.total());
+
+		if (isValidating && !isStale)
+			ValidateEnergyUpdate(bandView, energyMap, seam, seams, false);
+
+		isMaskGone = ModifyMask(cols, seam);
+		++seams;
+	}
 
-		if (start != -1 && end != -1)
-			toRemove.push_back({ start, end - start + 1, y });
+	img = buffer.Compact();
+	if (finalEnergyMap && !isStale)
+		*finalEnergyMap = energyMap;
+
+	if (bestSeams)
+		for (int best = bestSeams->load(); seams < best && !bestSeams->compare_exchange_weak(best, seams);)
+			;
+	return true;
+}
+
+bool RemoveObjectsInStrips(cv::Mat &img, const cv::Mat &biasMap, bool isVertical, CarveStats *stats, int refreshInterval)
+{
+	cv::Mat labels, objects, centroids;
+	int count = cv::connectedComponentsWithStats(brushMask, labels, objects, centroids, 8, CV_32S);
+
+	// the columns (rows for horizontal seams) every object covers, label 0 is the background
+	std::vector<std::pair<int, int>> groups;
+	for (int i = 1; i < count; ++i)
+	{
+		int begin = objects.at<int>(i, isVertical ? cv::CC_STAT_LEFT : cv::CC_STAT_TOP);
+		groups.push_back({ begin, begin + objects.at<int>(i, isVertical ? cv::CC_STAT_WIDTH : cv::CC_STAT_HEIGHT) });
+	}
+
+	// objects whose ranges overlap have to be removed by the same seams
+	std::sort(groups.begin(), groups.end());
+	size_t merged = 0;
+	for (size_t i = 1; i < groups.size(); ++i)
+	{
+		if (groups[i].first <= groups[merged].second)
+			groups[merged].second = std::max(groups[merged].second, groups[i].second);
+		else
+			groups[++merged] = groups[i];
 	}
+	groups.resize(std::min(groups.size(), merged + 1));
+
+	if (groups.size() < 2)
+		return false;
 
-	int max = 0;
-	for (const util::Mask& mask : toRemove)
-		max = std::max(max, mask.size);
+	// every strip holds one group, cut halfway through the gap to the next one
+	std::vector<int> cuts = { 0 };
+	for (size_t i = 1; i < groups.size(); ++i)
+		cuts.push_back((groups[i - 1].second + groups[i].first) / 2);
+	cuts.push_back(isVertical ? img.cols : img.rows);
 
-	// Choose the direction that requires fewer seams
-	bool useVerticalSeams = max < static_cast<int>(toRemove.size());
+	int strips = static_cast<int>(groups.size());
+	std::vector<cv::Mat> carved(strips);
+	std::vector<CarveStats> stripStats(strips);
 
-	// Now perform the actual removal using the better direction
-	if (useVerticalSeams)
+	// the strips are carved on separate threads, the windows and the stage profiler are not thread safe
+	bool wasHeadless = isHeadless, wasProfiling = prof::isProfiling;
+	isHeadless = true;
+	prof::isProfiling = false;
+
+	cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range)
 	{
-		std::vector<util::Mask> toRemoveVer;
-		for (int y = 0; y < brushMask.rows; ++y)
+		for (int i = range.start; i < range.end; ++i)
 		{
-			int start = -1;
-			int end = -1;
+			cv::Range strip(cuts[i], cuts[i + 1]);
+			carved[i] = (isVertical ? img.colRange(strip) : img.rowRange(strip)).clone();
+			cv::Mat stripBias = (isVertical ? biasMap.colRange(strip) : biasMap.rowRange(strip)).clone();
+			util::SpanMask spans = MakeSpanMask(isVertical ? brushMask.colRange(strip) : brushMask.rowRange(strip));
+
+			if (isVertical)
+				RemoveObjectVertical(carved[i], stripBias, spans.rows, &stripStats[i], refreshInterval);
+			else
+				RemoveObjectHorizontal(carved[i], stripBias, spans.cols, &stripStats[i], refreshInterval);
+		}
+	}, strips);
 
-			uchar *row = brushMask.ptr<uchar>(y);
-			for (int x = 0; x < brushMask.cols; ++x)
-			{
-				if (row[x] > 0)
-				{
-					if (start == -1) start = x;
-					end = x;
-				}
-			}
+	isHeadless = wasHeadless;
+	prof::isProfiling = wasProfiling;
 
-			if (start != -1 && end != -1)
-				toRemoveVer.push_back({ start, end - start + 1, y });
-		}
+	// every strip lost whole seams, so its rows (columns) still line up with the other strips
+	if (isVertical)
+		cv::hconcat(carved, img);
+	else
+		cv::vconcat(carved, img);
 
-		while (!toRemoveVer.empty())
+	if (stats)
+		for (const CarveStats &stripStat : stripStats)
 		{
-			std::vector<cv::Mat> channels;
-			cv::split(img, channels);
-			cv::Mat energyMap = CalculateEnergyMap(channels);
-			ModifyVerticalEnergyMap(energyMap, toRemoveVer, -min);
+			stats->seams += stripStat.seams;
+			stats->removedEnergy += stripStat.removedEnergy;
+			stats->staleEnergy += stripStat.staleEnergy;
+		}
 
-			cv::Mat cumMap = CalculateVerticalCumMap(energyMap);
-			std::vector<int> seam = FindVerticalSeamDP(cumMap);
+	return true;
+}
 
-			VisualizeVerticalSeam(img, seam, cv::Vec3b(0, 0, 255));
-			RemoveVerticalSeam(img, seam);
+void ContentAwareRemoval(cv::Mat &img, CarveStats *stats, int refreshInterval, bool isSpeculative, bool shldRestoreSize, const cv::Rect &roi)
+{
+	int brushedPixels = brushMask.empty() ? 0 : cv::countNonZero(brushMask);
+	if (brushedPixels == 0)
+		return;
 
-			if (ModifyMask(toRemoveVer, seam))
-				break;
+	if (brushMask.size() != img.size())
+	{
+		std::cerr << "Brush mask is " << brushMask.cols << "x" << brushMask.rows << " but image size is " << img.cols << "x" << img.rows << nl;
+		return;
+	}
+
+	// vertical seams only cross the columns of the ROI and horizontal seams its rows
+	cv::Range verticalBand = GetSeamBand(roi, img.size(), true), horizontalBand = GetSeamBand(roi, img.size(), false);
+
+	// the brush keeps its spans in step with the mask, a mask set or cleared any other way no longer covers the same pixels and is scanned once
+	auto countSpans = [](const std::vector<std::vector<util::Span>> &lines)
+	{
+		int count = 0;
+		for (const std::vector<util::Span> &line : lines)
+			count = std::accumulate(line.begin(), line.end(), count, [](int sum, const util::Span &span) { return sum + span.size; });
+		return count;
+	};
+
+	bool isSpansCurrent = brushSpans.rows.size() == static_cast<size_t>(img.rows) && brushSpans.cols.size() == static_cast<size_t>(img.cols) &&
+		countSpans(brushSpans.rows) == brushedPixels && countSpans(brushSpans.cols) == brushedPixels;
+	util::SpanMask spans = isSpansCurrent ? brushSpans : MakeSpanMask(brushMask);
+
+	// within an ROI only the brushed pixels in a band can be removed, the spans are relative to the start of the band
+	std::vector<std::vector<util::Span>> &rows = spans.rows, &cols = spans.cols;
+	if (!roi.empty())
+	{
+		rows = MakeSpanMask(brushMask.colRange(verticalBand)).rows;
+		cols = MakeSpanMask(brushMask.rowRange(horizontalBand)).cols;
+	}
+
+	// a seam removes at most one pixel from every row or column it crosses, so the most painted pixels on one is a lower bound on the seams
+	auto widest = [](const std::vector<std::vector<util::Span>> &lines)
+	{
+		int widest = 0;
+		for (const std::vector<util::Span> &line : lines)
+			widest = std::max(widest, std::accumulate(line.begin(), line.end(), 0, [](int sum, const util::Span &span) { return sum + span.size; }));
+		return widest;
+	};
+
+	if (!widest(rows) && !widest(cols))
+	{
+		std::cerr << "Nothing is brushed inside the ROI" << nl;
+		return;
+	}
+
+	cv::Size size = img.size();
+	cv::Mat energyMap; // exact energy of the carved band, left empty when the strips were carved on their own
+
+	if (!isSpeculative)
+	{
+		// Choose the direction that is likely to require fewer seams
+		bool useVerticalSeams = widest(rows) < widest(cols);
+		cv::Mat biasMap = MakeRemovalBiasMap(img.size());
+
+		// the strips would cut across the ROI, so within one the objects are removed together
+		if (!roi.empty() || !RemoveObjectsInStrips(img, biasMap, useVerticalSeams, stats, refreshInterval))
+		{
+			if (useVerticalSeams)
+				RemoveObjectVertical(img, biasMap, rows, stats, refreshInterval, nullptr, &energyMap, roi);
+			else
+				RemoveObjectHorizontal(img, biasMap, cols, stats, refreshInterval, nullptr, &energyMap, roi);
 		}
 	}
 	else
 	{
-		std::vector<util::Mask> toRemoveHor;
-		for (int x = 0; x < brushMask.cols; ++x)
-		{
-			int start = -1;
-			int end = -1;
+		// both directions run at once on their own copy, the windows and the stage profiler are not thread safe
+		bool wasHeadless = isHeadless, wasProfiling = prof::isProfiling;
+		isHeadless = true;
+		prof::isProfiling = false;
 
-			for (int y = 0; y < brushMask.rows; ++y)
-			{
-				if (brushMask.at<uchar>(y, x) > 0)
-				{
-					if (start == -1) start = y;
-					end = y;
-				}
-			}
+		cv::Mat imgVertical = img.clone(), imgHorizontal = img.clone();
+		cv::Mat biasVertical = MakeRemovalBiasMap(img.size()), biasHorizontal = biasVertical.clone();
+		cv::Mat energyVertical, energyHorizontal;
+		CarveStats statsVertical, statsHorizontal;
+		std::atomic<int> bestSeams = std::numeric_limits<int>::max();
+		bool isVerticalDone = false;
 
-			if (start != -1 && end != -1)
-				toRemoveHor.push_back({ start, end - start + 1, x });
-		}
+		std::thread vertical([&]() { isVerticalDone = RemoveObjectVertical(imgVertical, biasVertical, rows, &statsVertical, refreshInterval, &bestSeams, &energyVertical, roi); });
+		bool isHorizontalDone = RemoveObjectHorizontal(imgHorizontal, biasHorizontal, cols, &statsHorizontal, refreshInterval, &bestSeams, &energyHorizontal, roi);
+		vertical.join();
 
-		while (!toRemoveHor.empty())
-		{
-			std::vector<cv::Mat> channels;
-			cv::split(img, channels);
-			cv::Mat energyMap = CalculateEnergyMap(channels);
-			ModifyHorizontalEnergyMap(energyMap, toRemoveHor, -min);
+		isHeadless = wasHeadless;
+		prof::isProfiling = wasProfiling;
 
-			cv::Mat cumMap = CalculateHorizontalCumMap(energyMap);
-			std::vector<int> seam = FindHorizontalSeamDP(cumMap);
+		// fewer seams distort the rest of the image less, the lower removed energy breaks a tie
+		bool keepVertical = isVerticalDone && (!isHorizontalDone || statsVertical.seams < statsHorizontal.seams ||
+			(statsVertical.seams == statsHorizontal.seams && statsVertical.removedEnergy <= statsHorizontal.removedEnergy));
 
-			VisualizeHorizontalSeam(img, seam, cv::Vec3b(0, 0, 255));
-			RemoveHorizontalSeam(img, seam);
+		img = keepVertical ? imgVertical : imgHorizontal;
+		energyMap = keepVertical ? energyVertical : energyHorizontal;
 
-			if (ModifyMask(toRemoveHor, seam))
-				break;
+		if (stats)
+		{
+			const CarveStats &kept = keepVertical ? statsVertical : statsHorizontal;
+			stats->seams += kept.seams;
+			stats->removedEnergy += kept.removedEnergy;
+			stats->staleEnergy += kept.staleEnergy;
 		}
 	}
 
-	//brushMask = cv::Mat::zeros(img.size(), CV_8UC1);
+	// the band was carved on its own, the parts of the image on either side of it are joined back on unchanged
+	auto withoutEmpty = [](std::vector<cv::Mat> parts)
+	{
+		parts.erase(std::remove_if(parts.begin(), parts.end(), [](const cv::Mat &part) { return part.empty(); }), parts.end());
+		return parts;
+	};
+
+	// the object was removed along one direction, the same number of seams are inserted back along it, inside the same band
+	if (shldRestoreSize && img.cols < size.width)
+	{
+		verticalBand.end -= size.width - img.cols;
+		if (roi.empty())
+			VerticalSeamInsertion(img, size.width, nullptr, energyMap);
+		else
+		{
+			cv::Mat band = img.colRange(verticalBand).clone(), restored;
+			VerticalSeamInsertion(band, band.cols + size.width - img.cols, nullptr, energyMap);
+			cv::hconcat(withoutEmpty({ img.colRange(0, verticalBand.start), band, img.colRange(verticalBand.end, img.cols) }), restored);
+			img = restored;
+		}
+	}
+	if (shldRestoreSize && img.rows < size.height)
+	{
+		horizontalBand.end -= size.height - img.rows;
+		if (roi.empty())
+			HorizontalSeamInsertion(img, size.height, nullptr, energyMap);
+		else
+		{
+			cv::Mat band = img.rowRange(horizontalBand).clone(), restored;
+			HorizontalSeamInsertion(band, band.rows + size.height - img.rows, nullptr, energyMap);
+			cv::vconcat(withoutEmpty({ img.rowRange(0, horizontalBand.start), band, img.rowRange(horizontalBand.end, img.rows) }), restored);
+			img = restored;
+		}
+	}
 }
 
 
@@ -331,29 +686,22 @@ cv::Mat CalculateVerticalCumMap(const cv::Mat &energyMap)
 		cumMap.at<double>(rows - 1, j) = energyMap.at<double>(rows - 1, j);
 
 	// cumulatively sum best energy value from bottom to top, taking only 3 pixels into account
+	// every pixel is set to its mirror in the original energy map + the lowest value of the 3 adjacent pixels below it,
+	// by the row kernel of the instruction set picked at startup
+	simd::CumRowKernel cumRow = simd::GetCumRowKernel();
 	for (int i = rows - 2; i > -1; --i)
-		for (int j = 0; j < cols; ++j)
-		{
-			double leftVal = j ? cumMap.at<double>(i + 1, j - 1) : MAX;
-			double midVal = cumMap.at<double>(i + 1, j);
-			double rightVal = j < cols - 1 ? cumMap.at<double>(i + 1, j + 1) : MAX;
-			double minVal = std::min({ leftVal, midVal, rightVal });
-
-			// set the current pixel to its mirror in the original energy map + the lowest value of the 3 adjacent pixels below it
-			double &currVal = cumMap.at<double>(i, j);
-			currVal = energyMap.at<double>(i, j) + minVal;
-			max = currVal > max ? currVal : max;
-		}
+		max = cumRow(cumMap.ptr<double>(i + 1), energyMap.ptr<double>(i), nullptr, cumMap.ptr<double>(i), cols, max);
 
-	// normalise values to 0 to 255
-	for (int i = 0; i < rows; ++i)
-		for (int j = 0; j < cols; ++j)
-			cumMap.at<double>(i, j) = cumMap.at<double>(i, j) / max * 255.0;
+	// normalise values to 0 to 255, a map without a positive sum would turn into NaN or infinities and is left as it is
+	if (max > 0.0)
+		for (int i = 0; i < rows; ++i)
+			for (int j = 0; j < cols; ++j)
+				cumMap.at<double>(i, j) = cumMap.at<double>(i, j) / max * 255.0;
 
 	return cumMap;
 }
 
-cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap)
+cv::Mat CalculateVerticalCumMap(const cv::Mat &energyMap, const cv::Mat &biasMap)
 {
 	cv::Mat cumMap(energyMap.size(), CV_64F);
 	int rows = energyMap.rows, cols = energyMap.cols;
@@ -362,29 +710,122 @@ cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap)
 	if (!rows || !cols)
 		return cumMap;
 
+	// copy last row over with its bias
+	const double *energy = energyMap.ptr<double>(rows - 1), *bias = biasMap.ptr<double>(rows - 1);
+	double *last = cumMap.ptr<double>(rows - 1);
+	for (int j = 0; j < cols; ++j)
+		last[j] = energy[j] + bias[j];
+
+	// same sums as CalculateVerticalCumMap, the bias is added to every pixel as it is read instead of being written into the energy map
+	simd::CumRowKernel cumRow = simd::GetCumRowKernel();
+	for (int i = rows - 2; i > -1; --i)
+		max = cumRow(cumMap.ptr<double>(i + 1), energyMap.ptr<double>(i), biasMap.ptr<double>(i), cumMap.ptr<double>(i), cols, max);
+
+	// normalise values to 0 to 255, unless nothing is positive like in CalculateVerticalCumMap
+	if (max > 0.0)
+		for (int i = 0; i < rows; ++i)
+		{
+			double *row = cumMap.ptr<double>(i);
+			for (int j = 0; j < cols; ++j)
+				row[j] = row[j] / max * 255.0;
+		}
+
+	return cumMap;
+}
+
+cv::Mat CalculateVerticalCumMapTiled(const cv::Mat &energyMap, int tileCols, int blockRows)
+{
+	cv::Mat cumMap(energyMap.size(), CV_64F);
+	int rows = energyMap.rows, cols = energyMap.cols;
+
+	if (!rows || !cols)
+		return cumMap;
+
+	tileCols = std::max(1, tileCols);
+	blockRows = std::max(1, blockRows);
+	int tiles = (cols + tileCols - 1) / tileCols;
+	std::vector<double> tileMax(tiles, 0.0);
+
 	// copy last row over
-	for (int j = 0; j < rows; ++j)
-		cumMap.at<double>(j, cols - 1) = energyMap.at<double>(j, cols - 1);
+	energyMap.row(rows - 1).copyTo(cumMap.row(rows - 1));
 
-	for (int i = cols - 2; i > -1; --i)
-		for (int j = 0; j < rows; ++j)
+	// the same row kernel as CalculateVerticalCumMap, so every value is bit for bit equal
+	simd::CumRowKernel cumRow = simd::GetCumRowKernel();
+
+	// blockEnd is the finished row just below the block
+	for (int blockEnd = rows - 1; blockEnd > 0; blockEnd -= blockRows)
+	{
+		int blockBegin = std::max(0, blockEnd - blockRows);
+		int height = blockEnd - blockBegin;
+
+		cv::parallel_for_(cv::Range(0, tiles), [&](const cv::Range &range)
 		{
-			double leftVal = j ? cumMap.at<double>(j - 1, i + 1) : MAX;
-			double midVal = cumMap.at<double>(j, i + 1);
-			double rightVal = j < rows - 1 ? cumMap.at<double>(j + 1, i + 1) : MAX;
-			double minVal = std::min({ leftVal, midVal, rightVal });
+			std::vector<double> prev, curr;
 
-			// set the current pixel to its mirror in the original energy map + the lowest value of the 3 adjacent pixels below it
-			double &currVal = cumMap.at<double>(j, i);
-			currVal = energyMap.at<double>(j, i) + minVal;
-			max = currVal > max ? currVal : max;
-		}
+			for (int tile = range.start; tile < range.end; ++tile)
+			{
+				int tileBegin = tile * tileCols, tileEnd = std::min(cols, tileBegin + tileCols);
+				int haloBegin = std::max(0, tileBegin - height), haloEnd = std::min(cols, tileEnd + height);
 
-	// normalise values to 0 to 255
-	for (int i = 0; i < rows; ++i)
-		for (int j = 0; j < cols; ++j)
-			cumMap.at<double>(i, j) = cumMap.at<double>(i, j) / max * 255.0;
+				const double *finished = cumMap.ptr<double>(blockEnd);
+				prev.assign(finished + haloBegin, finished + haloEnd);
+				curr.resize(prev.size());
+				double max = tileMax[tile];
+
+				for (int i = blockEnd - 1; i >= blockBegin; --i)
+				{
+					// the row kernel treats the ends of the halo as image edges, the error this makes creeps inwards a column per row
+					// and does not reach the tile within a block, so only the tile's own columns are kept and count towards the maximum
+					cumRow(prev.data(), energyMap.ptr<double>(i) + haloBegin, nullptr, curr.data(), haloEnd - haloBegin, 0.0);
+
+					double *out = cumMap.ptr<double>(i);
+					for (int j = tileBegin; j < tileEnd; ++j)
+					{
+						double currVal = curr[j - haloBegin];
+						out[j] = currVal;
+						max = currVal > max ? currVal : max;
+					}
+
+					std::swap(prev, curr);
+				}
+
+				tileMax[tile] = max;
+			}
+		});
+	}
+
+	double max = *std::max_element(tileMax.begin(), tileMax.end());
+
+	// normalise values to 0 to 255, unless nothing is positive like in CalculateVerticalCumMap
+	if (max > 0.0)
+		cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+		{
+			for (int i = range.start; i < range.end; ++i)
+			{
+				double *row = cumMap.ptr<double>(i);
+				for (int j = 0; j < cols; ++j)
+					row[j] = row[j] / max * 255.0;
+			}
+		});
+
+	return cumMap;
+}
+
+cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap)
+{
+	// a column of the horizontal map is a row of the vertical map of the transposed energy, so the rows are summed contiguously by the row kernel
+	cv::Mat transposed, cumMap;
+	cv::transpose(energyMap, transposed);
+	cv::transpose(CalculateVerticalCumMap(transposed), cumMap);
+	return cumMap;
+}
 
+cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap, const cv::Mat &biasMap)
+{
+	cv::Mat transposedEnergy, transposedBias, cumMap;
+	cv::transpose(energyMap, transposedEnergy);
+	cv::transpose(biasMap, transposedBias);
+	cv::transpose(CalculateVerticalCumMap(transposedEnergy, transposedBias), cumMap);
 	return cumMap;
 }
 
@@ -426,6 +867,11 @@ std::vector<int> FindVerticalSeamGreedy(cv::Mat const& energyMap)
 	return seam;
 }
 
+int PickSeamStep(double leftVal, double midVal, double rightVal)
+{
+	return midVal <= leftVal && midVal <= rightVal ? 0 : leftVal <= rightVal ? -1 : 1;
+}
+
 std::vector<int> FindVerticalSeamDP(cv::Mat &cumMap)
 {
 	int rows = cumMap.rows, cols = cumMap.cols;
@@ -445,11 +891,11 @@ std::vector<int> FindVerticalSeamDP(cv::Mat &cumMap)
 	// find path of least resistance (aka the seam to cut)
 	for (int i = 0; i < rows - 1; ++i)
 	{
-		// select column that has the lowest energy
+		// select column that has the lowest energy, the middle one wins a tie and then the left one
 		double leftVal = col ? cumMap.at<double>(i + 1, col - 1) : MAX;
 		double midVal = cumMap.at<double>(i + 1, col);
 		double rightVal = col < cols - 1 ? cumMap.at<double>(i + 1, col + 1) : MAX;
-		seam[i + 1] = col = leftVal < midVal ? leftVal < rightVal ? col - 1 : col + 1 : midVal < rightVal ? col : col + 1;
+		seam[i + 1] = col += PickSeamStep(leftVal, midVal, rightVal);
 	}
 
 	return seam;
@@ -526,26 +972,65 @@ std::vector<int> FindVerticalSeamGraphCut(cv::Mat const& energyMap)
 	return seam;
 }
 
+double SumVerticalSeam(const cv::Mat &energyMap, std::vector<int> const &seam)
+{
+	double sum = 0.0;
+	for (int row{}; row < energyMap.rows; ++row)
+		sum += energyMap.at<double>(row, seam[row]);
+	return sum;
+}
 
-void RemoveVerticalSeam(cv::Mat &img, std::vector<int> const &seam)
+double CalculateVerticalSeamEnergy(const cv::Mat &img, std::vector<int> const &seam)
 {
-	int rows = img.rows;
-	int cols = img.cols;
+	double sum = 0.0;
+	for (int row{}; row < img.rows; ++row)
+		sum += CalculatePixelEnergy(img, row, seam[row]);
+	return sum;
+}
 
-	//remove the seam from the image
-	for (int row{}; row < rows; ++row)
+void RemoveVerticalSeamFromPlanes(std::vector<cv::Mat *> const &planes, std::vector<int> const &seam)
+{
+	std::vector<cv::Mat *> mats;
+	std::copy_if(planes.begin(), planes.end(), std::back_inserter(mats), [](cv::Mat *plane) { return plane; });
+	if (mats.empty())
+		return;
+
+	int rows = mats.front()->rows;
+	int cols = mats.front()->cols;
+
+	// every row is shifted independently, the pixels right of the seam move left as one contiguous span
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
 	{
-		int seamCol = seam[row];
-		for (int col = seamCol; col < cols - 1; ++col)
-			img.at<cv::Vec3b>(row, col) = img.at<cv::Vec3b>(row, col + 1);
-	}
+		for (int row = range.start; row < range.end; ++row)
+		{
+			int seamCol = seam[row];
+			for (cv::Mat *plane : mats)
+			{
+				size_t elemSize = plane->elemSize();
+				uchar *data = plane->ptr(row);
+				std::memmove(data + seamCol * elemSize, data + (seamCol + 1) * elemSize, (cols - seamCol - 1) * elemSize);
+			}
+		}
+	});
 
 	// resize the whole image 
-	img = img.colRange(0, cols - 1);
-	cv::imshow(CARVED_IMAGE, imgClone);
+	for (cv::Mat *plane : mats)
+		*plane = plane->colRange(0, cols - 1);
+}
+
+void RemoveVerticalSeam(cv::Mat &img, std::vector<int> const &seam, std::vector<cv::Mat *> const &planes)
+{
+	std::vector<cv::Mat *> all = { &img };
+	all.insert(all.end(), planes.begin(), planes.end());
+	RemoveVerticalSeamFromPlanes(all, seam);
 }
 
-void VerticalSeamCarvingGreedy(cv::Mat &img, int targetWidth)
+void RemoveVerticalSeamFromMap(cv::Mat &map, std::vector<int> const &seam)
+{
+	RemoveVerticalSeamFromPlanes({ &map }, seam);
+}
+
+void VerticalSeamCarvingGreedy(cv::Mat &img, int targetWidth, CarveStats *stats)
 {
 	if (targetWidth >= img.cols)
 	{
@@ -553,24 +1038,43 @@ void VerticalSeamCarvingGreedy(cv::Mat &img, int targetWidth)
 		return;
 	}
 
-	while (img.cols > targetWidth)
+	CarveBuffer buffer(img);
+
+	while (buffer.width > targetWidth)
 	{
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::ENERGY);
 		std::vector<cv::Mat> channels;
 
-		cv::split(img, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+		cv::split(view, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
 
 		// recalculate energy map
 		cv::Mat energyMap = CalculateEnergyMap(channels);
+		prof::EndStage(prof::ENERGY, view.total());
 
+		prof::BeginStage(prof::FIND_SEAM);
 		std::vector<int> seam = FindVerticalSeamGreedy(energyMap);
+		prof::EndStage(prof::FIND_SEAM, view.total());
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += SumVerticalSeam(energyMap, seam);
+		}
 
 		//if (img.cols + 1 == targetWidth)
-		VisualizeVerticalSeam(img, seam, (0, 0, 255));
-		RemoveVerticalSeam(img, seam);
+		VisualizeVerticalSeam(view, seam, (0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveVerticalSeam(seam);
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
 	}
+
+	img = buffer.Compact();
 }
 
-void VerticalSeamCarvingDP(cv::Mat &img, int targetWidth)
+void VerticalSeamCarvingDP(cv::Mat &img, int targetWidth, CarveStats *stats, int refreshInterval, cv::Mat *biasMap, const cv::Rect &roi)
 {
 	if (targetWidth >= img.cols)
 	{
@@ -578,25 +1082,106 @@ void VerticalSeamCarvingDP(cv::Mat &img, int targetWidth)
 		return;
 	}
 
-	while (img.cols > targetWidth)
+	// the seams only run through these columns, the ones right of them just shift left with every seam
+	cv::Range band = GetSeamBand(roi, img.size(), true);
+	if (band.size() <= img.cols - targetWidth)
 	{
-		std::vector<cv::Mat> channels;
-		cv::split(img, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+		std::cerr << "ROI is " << band.size() << " columns wide but " << img.cols - targetWidth << " seams have to be removed" << nl;
+		return;
+	}
 
-		// recalculate energy map
-		cv::Mat energyMap = CalculateEnergyMap(channels);
-		cv::normalize(energyMap, energyMap, 0, 255, cv::NORM_MINMAX);
+	cv::Mat energyMap;
+	int seamsSinceRefresh = 0;
+	bool hasBias = biasMap && biasMap->size() == img.size(); // a bias for another size is ignored
 
-		cv::Mat cumMap = CalculateVerticalCumMap(energyMap);
-		std::vector<int> seam = FindVerticalSeamDP(cumMap);
+	CarveBuffer buffer(img);
 
-		//if (img.cols + 1 == targetWidth)
-		VisualizeVerticalSeam(img, seam, (0, 0, 255));
-		RemoveVerticalSeam(img, seam);
-	}
-}
+	while (buffer.width > targetWidth)
+	{
+		cv::Mat view = buffer.View();
+		cv::Mat roiView = view.colRange(band);
+
+		prof::BeginStage(prof::ENERGY);
+
+		// recalculate energy map, in between refreshes the last one is shrunk along every removed seam
+		bool isRefreshed = refreshInterval <= 1 || seamsSinceRefresh++ % refreshInterval == 0;
+		if (isRefreshed)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(roiView, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+			energyMap = CalculateEnergyMap(channels);
+		}
+
+		// the bias is in units of the unnormalised energy, like the bias of object removal, so a biased map is not normalised,
+		// and the bidirectional search needs the integer energy to sum its two halves exactly
+		bool isSplit = isBidirectional && !hasBias;
+		cv::Mat normEnergyMap;
+		if (hasBias || isSplit)
+			normEnergyMap = energyMap;
+		else
+			cv::normalize(energyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+		prof::EndStage(prof::ENERGY, roiView.total());
+
+		// the bidirectional search fills its own halves of the map, so all of it is counted as finding the seam
+		cv::Mat cumMap;
+		std::vector<int> seam;
+		if (isSplit)
+		{
+			prof::BeginStage(prof::FIND_SEAM);
+			seam = FindVerticalSeamBidirectional(energyMap);
+			prof::EndStage(prof::FIND_SEAM, roiView.total());
+		}
+		else
+		{
+			prof::BeginStage(prof::CUM_MAP);
+			cumMap = hasBias ? CalculateVerticalCumMap(normEnergyMap, biasMap->colRange(band)) :
+				roiView.cols >= TILED_CUM_MAP_MIN_COLS ? CalculateVerticalCumMapTiled(normEnergyMap) : CalculateVerticalCumMap(normEnergyMap);
+			prof::EndStage(prof::CUM_MAP, roiView.total());
+
+			prof::BeginStage(prof::FIND_SEAM);
+			seam = FindVerticalSeamDP(cumMap);
+			prof::EndStage(prof::FIND_SEAM, roiView.total());
+		}
+
+		// the reference backend is run on the same inputs, outside the profiled stages
+		int seamIndex = img.cols - buffer.width;
+		if (isValidating && isSplit)
+			ValidateBidirectionalSeam(roiView, isRefreshed ? energyMap : cv::Mat(), energyMap, seam, seamIndex, true);
+		else if (isValidating)
+			ValidateSeamKernels(roiView, isRefreshed ? energyMap : cv::Mat(), normEnergyMap, hasBias ? biasMap->colRange(band) : cv::Mat(), cumMap, seam, seamIndex, true);
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->staleEnergy += SumVerticalSeam(energyMap, seam);
+			stats->removedEnergy += refreshInterval <= 1 ? SumVerticalSeam(energyMap, seam) : CalculateVerticalSeamEnergy(roiView, seam);
+		}
+
+		// the seam was found in the band, the image removes it at the same columns offset by the start of the band
+		std::vector<int> imgSeam(seam);
+		for (int &col : imgSeam)
+			col += band.start;
 
-void VerticalSeamCarvingGraphCut(cv::Mat& img, int targetWidth)
+		//if (img.cols + 1 == targetWidth)
+		VisualizeVerticalSeam(view, imgSeam, (0, 0, 255));
+
+		cv::Mat expected = isValidating ? ReferenceRemoveSeam(view, imgSeam, true) : cv::Mat();
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveVerticalSeam(imgSeam, { hasBias ? biasMap : nullptr });
+		if (refreshInterval > 1)
+			RemoveVerticalSeamFromMap(energyMap, seam);
+		--band.end;
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+
+		if (isValidating)
+			ValidateSeamRemoval(expected, buffer.View(), seamIndex);
+	}
+
+	img = buffer.Compact();
+}
+
+void VerticalSeamCarvingGraphCut(cv::Mat& img, int targetWidth, CarveStats *stats)
 {
 	if (targetWidth >= img.cols)
 	{
@@ -604,20 +1189,39 @@ void VerticalSeamCarvingGraphCut(cv::Mat& img, int targetWidth)
 		return;
 	}
 
-	while (img.cols > targetWidth)
+	CarveBuffer buffer(img);
+
+	while (buffer.width > targetWidth)
 	{
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::ENERGY);
 		std::vector<cv::Mat> channels;
 
-		cv::split(img, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+		cv::split(view, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
 
 		// recalculate energy map
 		cv::Mat energyMap = CalculateEnergyMap(channels);
+		prof::EndStage(prof::ENERGY, view.total());
 
+		prof::BeginStage(prof::FIND_SEAM);
 		std::vector<int> seam = FindVerticalSeamGraphCut(energyMap);
+		prof::EndStage(prof::FIND_SEAM, view.total());
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += SumVerticalSeam(energyMap, seam);
+		}
 		//if (img.cols + 1 == targetWidth)
-		VisualizeVerticalSeam(img, seam, (255, 0, 255));
-		RemoveVerticalSeam(img, seam);
+		VisualizeVerticalSeam(view, seam, (255, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveVerticalSeam(seam);
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
 	}
+
+	img = buffer.Compact();
 }
 
 // ===============
@@ -676,11 +1280,11 @@ std::vector<int> FindHorizontalSeamDP(cv::Mat &cumMap)
 	// find path of least resistance (aka the seam to cut)
 	for (int i = 0; i < cols - 1; ++i)
 	{
-		// select column that has the lowest energy
+		// select row that has the lowest energy, the middle one wins a tie and then the upper one
 		double leftVal = row ? cumMap.at<double>(row - 1, i + 1) : MAX;
 		double midVal = cumMap.at<double>(row, i + 1);
 		double rightVal = row < rows - 1 ? cumMap.at<double>(row + 1, i + 1) : MAX;
-		seam[i + 1] = row = leftVal < midVal ? leftVal < rightVal ? row - 1 : row + 1 : midVal < rightVal ? row : row + 1;
+		seam[i + 1] = row += PickSeamStep(leftVal, midVal, rightVal);
 	}
 
 	return seam;
@@ -758,26 +1362,79 @@ std::vector<int> FindHorizontalSeamGraphCut(cv::Mat const& energyMap)
 	return seam;
 }
 
-void RemoveHorizontalSeam(cv::Mat &img, std::vector<int> const &seam)
+double SumHorizontalSeam(const cv::Mat &energyMap, std::vector<int> const &seam)
 {
-	int rows = img.rows;
-	int cols = img.cols;
+	double sum = 0.0;
+	for (int col{}; col < energyMap.cols; ++col)
+		sum += energyMap.at<double>(seam[col], col);
+	return sum;
+}
+
+double CalculateHorizontalSeamEnergy(const cv::Mat &img, std::vector<int> const &seam)
+{
+	double sum = 0.0;
+	for (int col{}; col < img.cols; ++col)
+		sum += CalculatePixelEnergy(img, seam[col], col);
+	return sum;
+}
+
+void RemoveHorizontalSeamFromPlanes(std::vector<cv::Mat *> const &planes, std::vector<int> const &seam)
+{
+	std::vector<cv::Mat *> mats;
+	std::copy_if(planes.begin(), planes.end(), std::back_inserter(mats), [](cv::Mat *plane) { return plane; });
+	if (mats.empty())
+		return;
 
-	//remove the seam from the image
-	for (int col{ }; col < cols; ++col)
+	int rows = mats.front()->rows;
+	int cols = mats.front()->cols;
+
+	// a row takes pixels from the row below it, so threads split the columns and walk their stripe from top to bottom
+	cv::parallel_for_(cv::Range(0, cols), [&](const cv::Range &range)
 	{
-		int seamRow = seam[col];
-		for (int row = seamRow; row < rows - 1; ++row)
-			img.at<cv::Vec3b>(row, col) = img.at<cv::Vec3b>(row + 1, col);
+		int startRow = *std::min_element(seam.begin() + range.start, seam.begin() + range.end);
 
-	}
+		for (int row = startRow; row < rows - 1; ++row)
+			for (int col = range.start; col < range.end;)
+			{
+				if (seam[col] > row)
+				{
+					++col;
+					continue;
+				}
+
+				// contiguous run of columns whose seam is at or above this row
+				int end = col + 1;
+				while (end < range.end && seam[end] <= row)
+					++end;
+
+				for (cv::Mat *plane : mats)
+				{
+					size_t elemSize = plane->elemSize();
+					std::memcpy(plane->ptr(row) + col * elemSize, plane->ptr(row + 1) + col * elemSize, (end - col) * elemSize);
+				}
+
+				col = end;
+			}
+	}, std::max(1.0, cols / 256.0));
 
 	// resize the whole image 
-	img = img.rowRange(0, rows - 1);
-	cv::imshow(CARVED_IMAGE, imgClone);
+	for (cv::Mat *plane : mats)
+		*plane = plane->rowRange(0, rows - 1);
+}
+
+void RemoveHorizontalSeam(cv::Mat &img, std::vector<int> const &seam, std::vector<cv::Mat *> const &planes)
+{
+	std::vector<cv::Mat *> all = { &img };
+	all.insert(all.end(), planes.begin(), planes.end());
+	RemoveHorizontalSeamFromPlanes(all, seam);
+}
+
+void RemoveHorizontalSeamFromMap(cv::Mat &map, std::vector<int> const &seam)
+{
+	RemoveHorizontalSeamFromPlanes({ &map }, seam);
 }
 
-void HorizontalSeamCarvingGreedy(cv::Mat& img, int targetHeight)
+void HorizontalSeamCarvingGreedy(cv::Mat& img, int targetHeight, CarveStats *stats)
 {
 	if (targetHeight >= img.rows)
 	{
@@ -785,24 +1442,43 @@ void HorizontalSeamCarvingGreedy(cv::Mat& img, int targetHeight)
 		return;
 	}
 
-	while (img.rows > targetHeight)
+	CarveBuffer buffer(img);
+
+	while (buffer.height > targetHeight)
 	{
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::ENERGY);
 		std::vector<cv::Mat> channels;
 
-		cv::split(img, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+		cv::split(view, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
 
 		// recalculate energy map
 		cv::Mat energyMap = CalculateEnergyMap(channels);
+		prof::EndStage(prof::ENERGY, view.total());
 
+		prof::BeginStage(prof::FIND_SEAM);
 		std::vector<int> seam = FindHorizontalSeamGreedy(energyMap);
+		prof::EndStage(prof::FIND_SEAM, view.total());
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += SumHorizontalSeam(energyMap, seam);
+		}
 
 		//if (img.rows + 1 == targetHeight)
-		VisualizeHorizontalSeam(img, seam, (0, 0, 255));
-		RemoveHorizontalSeam(img, seam);
+		VisualizeHorizontalSeam(view, seam, (0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveHorizontalSeam(seam);
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
 	}
+
+	img = buffer.Compact();
 }
 
-void HorizontalSeamCarvingDP(cv::Mat& img, int targetHeight)
+void HorizontalSeamCarvingDP(cv::Mat& img, int targetHeight, CarveStats *stats, int refreshInterval, cv::Mat *biasMap, const cv::Rect &roi)
 {
 	if (targetHeight >= img.rows)
 	{
@@ -810,24 +1486,105 @@ void HorizontalSeamCarvingDP(cv::Mat& img, int targetHeight)
 		return;
 	}
 
-	while (img.rows > targetHeight)
+	// the seams only run through these rows, the ones below them just shift up with every seam
+	cv::Range band = GetSeamBand(roi, img.size(), false);
+	if (band.size() <= img.rows - targetHeight)
 	{
-		std::vector<cv::Mat> channels;
-		cv::split(img, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+		std::cerr << "ROI is " << band.size() << " rows high but " << img.rows - targetHeight << " seams have to be removed" << nl;
+		return;
+	}
 
-		// recalculate energy map
-		cv::Mat energyMap = CalculateEnergyMap(channels);
-		cv::normalize(energyMap, energyMap, 0, 255, cv::NORM_MINMAX);
-		energyMap = CalculateHorizontalCumMap(energyMap);
+	cv::Mat energyMap;
+	int seamsSinceRefresh = 0;
+	bool hasBias = biasMap && biasMap->size() == img.size(); // a bias for another size is ignored
+
+	CarveBuffer buffer(img);
+
+	while (buffer.height > targetHeight)
+	{
+		cv::Mat view = buffer.View();
+		cv::Mat roiView = view.rowRange(band);
+
+		prof::BeginStage(prof::ENERGY);
+
+		// recalculate energy map, in between refreshes the last one is shrunk along every removed seam
+		bool isRefreshed = refreshInterval <= 1 || seamsSinceRefresh++ % refreshInterval == 0;
+		if (isRefreshed)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(roiView, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+			energyMap = CalculateEnergyMap(channels);
+		}
+
+		// the bias is in units of the unnormalised energy, like the bias of object removal, so a biased map is not normalised,
+		// and the bidirectional search needs the integer energy to sum its two halves exactly
+		bool isSplit = isBidirectional && !hasBias;
+		cv::Mat normEnergyMap;
+		if (hasBias || isSplit)
+			normEnergyMap = energyMap;
+		else
+			cv::normalize(energyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+		prof::EndStage(prof::ENERGY, roiView.total());
+
+		// a horizontal seam is the vertical bidirectional seam of the transposed energy
+		cv::Mat cumMap;
+		std::vector<int> seam;
+		if (isSplit)
+		{
+			prof::BeginStage(prof::FIND_SEAM);
+			seam = FindVerticalSeamBidirectional(energyMap.t());
+			prof::EndStage(prof::FIND_SEAM, roiView.total());
+		}
+		else
+		{
+			prof::BeginStage(prof::CUM_MAP);
+			cumMap = hasBias ? CalculateHorizontalCumMap(normEnergyMap, biasMap->rowRange(band)) : CalculateHorizontalCumMap(normEnergyMap);
+			prof::EndStage(prof::CUM_MAP, roiView.total());
+
+			prof::BeginStage(prof::FIND_SEAM);
+			seam = FindHorizontalSeamDP(cumMap);
+			prof::EndStage(prof::FIND_SEAM, roiView.total());
+		}
+
+		// the reference backend is run on the same inputs, outside the profiled stages
+		int seamIndex = img.rows - buffer.height;
+		if (isValidating && isSplit)
+			ValidateBidirectionalSeam(roiView, isRefreshed ? energyMap : cv::Mat(), energyMap, seam, seamIndex, false);
+		else if (isValidating)
+			ValidateSeamKernels(roiView, isRefreshed ? energyMap : cv::Mat(), normEnergyMap, hasBias ? biasMap->rowRange(band) : cv::Mat(), cumMap, seam, seamIndex, false);
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->staleEnergy += SumHorizontalSeam(energyMap, seam);
+			stats->removedEnergy += refreshInterval <= 1 ? SumHorizontalSeam(energyMap, seam) : CalculateHorizontalSeamEnergy(roiView, seam);
+		}
+
+		// the seam was found in the band, the image removes it at the same rows offset by the start of the band
+		std::vector<int> imgSeam(seam);
+		for (int &row : imgSeam)
+			row += band.start;
 
-		std::vector<int> seam = FindHorizontalSeamDP(energyMap);
 		//if (img.rows + 1 == targetHeight)
-		VisualizeHorizontalSeam(img, seam, (0, 0, 255));
-		RemoveHorizontalSeam(img, seam);
+		VisualizeHorizontalSeam(view, imgSeam, (0, 0, 255));
+
+		cv::Mat expected = isValidating ? ReferenceRemoveSeam(view, imgSeam, false) : cv::Mat();
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveHorizontalSeam(imgSeam, { hasBias ? biasMap : nullptr });
+		if (refreshInterval > 1)
+			RemoveHorizontalSeamFromMap(energyMap, seam);
+		--band.end;
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+
+		if (isValidating)
+			ValidateSeamRemoval(expected, buffer.View(), seamIndex);
 	}
+
+	img = buffer.Compact();
 }
 
-void HorizontalSeamCarvingGraphCut(cv::Mat& img, int targetHeight)
+void HorizontalSeamCarvingGraphCut(cv::Mat& img, int targetHeight, CarveStats *stats)
 {
 	if (targetHeight >= img.rows)
 	{
@@ -835,71 +1592,1415 @@ void HorizontalSeamCarvingGraphCut(cv::Mat& img, int targetHeight)
 		return;
 	}
 
-	while (img.rows > targetHeight)
+	CarveBuffer buffer(img);
+
+	while (buffer.height > targetHeight)
 	{
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::ENERGY);
 		std::vector<cv::Mat> channels;
 
-		cv::split(img, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
+		cv::split(view, channels); // channels[0] = blue, channels[1] = green, channels[2] = red
 
 		// recalculate energy map
 		cv::Mat energyMap = CalculateEnergyMap(channels);
+		prof::EndStage(prof::ENERGY, view.total());
 
+		prof::BeginStage(prof::FIND_SEAM);
 		std::vector<int> seam = FindHorizontalSeamGraphCut(energyMap);
+		prof::EndStage(prof::FIND_SEAM, view.total());
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += SumHorizontalSeam(energyMap, seam);
+		}
 
 		//if (img.rows + 1 == targetHeight)
-		VisualizeHorizontalSeam(img, seam, (0, 0, 255));
-		RemoveHorizontalSeam(img, seam);
+		VisualizeHorizontalSeam(view, seam, (0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveHorizontalSeam(seam);
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
 	}
+
+	img = buffer.Compact();
 }
 
 // ===============
-// VISUALIZATION
+// DEADLINE CARVING
 // ===============
 
-void VisualizeVerticalSeam(cv::Mat& img, std::vector<int> const& seam, cv::Vec3b const& colour)
+void VerticalSeamCarvingDeadline(cv::Mat &img, int targetWidth, double budgetMs, CarveStats *stats)
 {
-	// assign colour to the seam for visualization
-	for (int i{}; i < img.rows; ++i)
+	if (targetWidth >= img.cols)
 	{
-		img.at<cv::Vec3b>(i, seam[i]) = colour;
-		allSeams.at<cv::Vec3b>(i, seam[i]) = colour;
+		std::cerr << "Target width is " << targetWidth << " but image width is " << img.cols << nl;
+		return;
 	}
 
-	if (editor.GetWindow<edit::WindowsManager>()->shldOpenCarvedImage)
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	auto elapsedMs = [&]() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count(); };
+
+	// conservative ns per pixel per seam until a strategy has been measured on this image
+	std::array<double, MAX_STRATEGY> msPerSeam =
 	{
-		util::ShowWindow(CARVED_IMAGE_W, true);
-		cv::imshow(CARVED_IMAGE, img);
-		winManager.CIWin = true;
+		120e-6 * img.total(),
+		60e-6 * img.total(),
+		40e-6 * img.total(),
+		0.0
+	};
+	std::array<bool, MAX_STRATEGY> isMeasured{};
+
+	const int refreshInterval = 8; // seams between energy recomputations for STALE_ENERGY
+	const double reserveMs = budgetMs * 0.05; // kept back for the final resize
+	int strategy = EXACT_DP;
+	int staleSeams = 0;
+	cv::Mat staleEnergy;
+	cv::Mat corridorEnergy; // allocated once for DOWNSCALED_SEARCH, only the corridor of every seam is filled
+	bool isResized = false;
+
+	CarveBuffer buffer(img);
+
+	while (buffer.width > targetWidth)
+	{
+		cv::Mat view = buffer.View();
+		int remaining = buffer.width - targetWidth;
+		double leftMs = budgetMs - reserveMs - elapsedMs();
+
+		// move to a cheaper strategy while the current one is predicted to overrun
+		while (strategy < PLAIN_RESIZE && msPerSeam[strategy] * remaining > leftMs)
+			++strategy;
+
+		// the downscaled search needs at least 2 pixels in both directions after halving
+		if (strategy == DOWNSCALED_SEARCH && (view.cols < 8 || view.rows < 8))
+			strategy = PLAIN_RESIZE;
+
+		if (strategy == PLAIN_RESIZE || leftMs <= 0.0)
+		{
+			// the result gets its own allocation, so the buffer is not compacted
+			cv::resize(view, img, cv::Size(targetWidth, view.rows), 0, 0, cv::INTER_AREA);
+			isResized = true;
+			if (stats)
+				stats->strategySeams[PLAIN_RESIZE] += remaining;
+			break;
+		}
+
+		double seamBegin = elapsedMs();
+		std::vector<int> seam;
+		cv::Mat energyMap;
+
+		switch (strategy)
+		{
+		case EXACT_DP:
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(view, channels);
+			energyMap = CalculateEnergyMap(channels);
+
+			cv::Mat normEnergyMap;
+			cv::normalize(energyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+			cv::Mat cumMap = CalculateVerticalCumMap(normEnergyMap);
+			seam = FindVerticalSeamDP(cumMap);
+			break;
+		}
+
+		case STALE_ENERGY:
+		{
+			// counted on every seam, so the map is refreshed every refreshInterval seams and not only once
+			if (staleSeams++ % refreshInterval == 0 || staleEnergy.empty())
+			{
+				std::vector<cv::Mat> channels;
+				cv::split(view, channels);
+				staleEnergy = CalculateEnergyMap(channels);
+			}
+
+			energyMap = staleEnergy;
+			cv::Mat normEnergyMap;
+			cv::normalize(staleEnergy, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+			cv::Mat cumMap = CalculateVerticalCumMap(normEnergyMap);
+			seam = FindVerticalSeamDP(cumMap);
+			break;
+		}
+
+		case DOWNSCALED_SEARCH:
+		{
+			cv::Mat small;
+			cv::resize(view, small, cv::Size(view.cols / 2, view.rows / 2), 0, 0, cv::INTER_AREA);
+
+			std::vector<cv::Mat> channels;
+			cv::split(small, channels);
+			cv::Mat smallEnergy = CalculateEnergyMap(channels);
+			cv::normalize(smallEnergy, smallEnergy, 0, 255, cv::NORM_MINMAX);
+			cv::Mat cumMap = CalculateVerticalCumMap(smallEnergy);
+			std::vector<int> smallSeam = FindVerticalSeamDP(cumMap);
+
+			// every low resolution pixel covers 2x2 full resolution pixels, so the upscaled path can step 2 columns between rows
+			std::vector<int> path(view.rows);
+			for (int row{}; row < view.rows; ++row)
+				path[row] = std::min(view.cols - 1, smallSeam[std::min(row / 2, small.rows - 1)] * 2);
+
+			// a corridor of 1 column either side always holds a connected seam, only its energy is calculated
+			if (corridorEnergy.empty())
+				corridorEnergy.create(view.size(), CV_64F);
+			cv::Mat energy = corridorEnergy(cv::Rect(0, 0, view.cols, view.rows));
+			for (int row{}; row < view.rows; ++row)
+				for (int col = std::max(0, path[row] - 1); col <= std::min(view.cols - 1, path[row] + 1); ++col)
+					energy.at<double>(row, col) = CalculatePixelEnergy(view, row, col);
+
+			seam = FindVerticalSeamInCorridor(energy, path, 1);
+			break;
+		}
+		}
+
+		if (stats)
+		{
+			++stats->seams;
+			++stats->strategySeams[strategy];
+			stats->removedEnergy += strategy == EXACT_DP ? SumVerticalSeam(energyMap, seam) : CalculateVerticalSeamEnergy(view, seam);
+			if (!energyMap.empty())
+				stats->staleEnergy += SumVerticalSeam(energyMap, seam);
+		}
+
+		VisualizeVerticalSeam(view, seam, cv::Vec3b(0, 0, 255));
+
+		// the stale energy map shares its memory with energyMap, so only shrink it once
+		buffer.RemoveVerticalSeam(seam, { strategy == STALE_ENERGY ? &staleEnergy : nullptr });
+
+		// running average of the measured cost, the first measurement replaces the estimate
+		double seamMs = elapsedMs() - seamBegin;
+		msPerSeam[strategy] = isMeasured[strategy] ? 0.8 * msPerSeam[strategy] + 0.2 * seamMs : seamMs;
+		isMeasured[strategy] = true;
 	}
-	else
+
+	if (!isResized)
+		img = buffer.Compact();
+
+	if (stats)
+		stats->elapsedMs += elapsedMs();
+}
+
+void HorizontalSeamCarvingDeadline(cv::Mat &img, int targetHeight, double budgetMs, CarveStats *stats)
+{
+	if (targetHeight >= img.rows)
 	{
-		if (winManager.CIWin)
+		std::cerr << "Target height is " << targetHeight << " but image height is " << img.rows << nl;
+		return;
+	}
+
+	// the seams and the carved image would be shown transposed, so keep the windows closed
+	bool wasHeadless = isHeadless;
+	isHeadless = true;
+
+	cv::Mat transposed;
+	cv::transpose(img, transposed);
+	VerticalSeamCarvingDeadline(transposed, targetHeight, budgetMs, stats);
+	cv::transpose(transposed, img);
+
+	isHeadless = wasHeadless;
+}
+
+std::string DescribeStrategies(const CarveStats &stats)
+{
+	std::string ret;
+	for (int i{}; i < MAX_STRATEGY; ++i)
+		if (stats.strategySeams[i])
+			ret += (ret.empty() ? "" : ", ") + std::string(STRATEGY_NAMES[i]) + " " + std::to_string(stats.strategySeams[i]);
+	return ret.empty() ? "none" : ret;
+}
+
+// ===============
+// PYRAMID CARVING
+// ===============
+
+double CalculatePixelEnergy(const cv::Mat &img, int row, int col)
+{
+	int rows = img.rows, cols = img.cols, channels = img.channels();
+
+	// same border as cv::Sobel, the row or column next to the edge is mirrored
+	auto reflect = [](int i, int n) { return n == 1 ? 0 : i < 0 ? -i : i >= n ? 2 * n - 2 - i : i; };
+	int up = reflect(row - 1, rows), down = reflect(row + 1, rows);
+	int left = reflect(col - 1, cols), right = reflect(col + 1, cols);
+
+	const uchar *above = img.ptr<uchar>(up), *curr = img.ptr<uchar>(row), *below = img.ptr<uchar>(down);
+	double energy = 0.0;
+
+	for (int c{}; c < channels; ++c)
+	{
+		auto at = [&](const uchar *line, int x) { return static_cast<double>(line[x * channels + c]); };
+
+		double gradX = at(above, right) - at(above, left) + 2.0 * (at(curr, right) - at(curr, left)) + at(below, right) - at(below, left);
+		double gradY = at(below, left) - at(above, left) + 2.0 * (at(below, col) - at(above, col)) + at(below, right) - at(above, right);
+		energy += std::abs(gradX) + std::abs(gradY);
+	}
+
+	return energy;
+}
+
+void UpdateVerticalEnergyMap(const cv::Mat &img, cv::Mat &energyMap, std::vector<int> const &seam)
+{
+	int rows = img.rows, cols = img.cols;
+
+	// a pixel changes when a removed pixel was in its 3x3 neighbourhood, seams move at most 1 column per row
+	for (int row{}; row < rows; ++row)
+	{
+		int startCol = std::max(0, seam[row] - 2);
+		int endCol = std::min(cols - 1, seam[row] + 1);
+
+		double *energy = energyMap.ptr<double>(row);
+		for (int col = startCol; col <= endCol; ++col)
+			energy[col] = CalculatePixelEnergy(img, row, col);
+	}
+}
+
+void UpdateHorizontalEnergyMap(const cv::Mat &img, cv::Mat &energyMap, std::vector<int> const &seam)
+{
+	int rows = img.rows, cols = img.cols;
+
+	// same neighbourhood as UpdateVerticalEnergyMap with rows and columns swapped
+	for (int col{}; col < cols; ++col)
+	{
+		int startRow = std::max(0, seam[col] - 2);
+		int endRow = std::min(rows - 1, seam[col] + 1);
+
+		for (int row = startRow; row <= endRow; ++row)
+			energyMap.at<double>(row, col) = CalculatePixelEnergy(img, row, col);
+	}
+}
+
+std::vector<int> FindVerticalSeamInCorridor(const cv::Mat &energyMap, std::vector<int> const &path, int radius)
+{
+	int rows = energyMap.rows, cols = energyMap.cols;
+	int width = 2 * radius + 1;
+	std::vector<int> seam(rows);
+
+	if (!rows || !cols)
+		return seam;
+
+	// cumulative map of the corridor only, column j of row i is image column startCols[i] + j
+	std::vector<double> cumMap(static_cast<size_t>(rows) * width, MAX);
+	std::vector<int> startCols(rows), endCols(rows);
+	for (int i{}; i < rows; ++i)
+	{
+		startCols[i] = std::max(0, std::min(path[i], cols - 1) - radius);
+		endCols[i] = std::min(cols - 1, std::max(path[i], 0) + radius);
+	}
+
+	auto cumAt = [&](int i, int col) { return col < startCols[i] || col > endCols[i] ? MAX : cumMap[static_cast<size_t>(i) * width + col - startCols[i]]; };
+
+	for (int col = startCols[rows - 1]; col <= endCols[rows - 1]; ++col)
+		cumMap[static_cast<size_t>(rows - 1) * width + col - startCols[rows - 1]] = energyMap.at<double>(rows - 1, col);
+
+	for (int i = rows - 2; i > -1; --i)
+	{
+		const double *energy = energyMap.ptr<double>(i);
+		for (int col = startCols[i]; col <= endCols[i]; ++col)
 		{
-			util::ShowWindow(CARVED_IMAGE_W, false);
-			winManager.CIWin = false;
+			double minVal = std::min({ cumAt(i + 1, col - 1), cumAt(i + 1, col), cumAt(i + 1, col + 1) });
+
+			// pixels that cannot reach the bottom row inside the corridor stay at MAX
+			if (minVal < MAX)
+				cumMap[static_cast<size_t>(i) * width + col - startCols[i]] = energy[col] + minVal;
 		}
 	}
 
-	if (editor.GetWindow<edit::WindowsManager>()->shldOpenAllSeams)
+	// same walk and tie breaking as FindVerticalSeamDP
+	int col = startCols[0];
+	for (int j = startCols[0] + 1; j <= endCols[0]; ++j)
+		col = cumAt(0, j) < cumAt(0, col) ? j : col;
+	seam[0] = col;
+
+	for (int i = 0; i < rows - 1; ++i)
+		seam[i + 1] = col += PickSeamStep(cumAt(i + 1, col - 1), cumAt(i + 1, col), cumAt(i + 1, col + 1));
+
+	return seam;
+}
+
+void VerticalSeamCarvingPyramid(cv::Mat &img, int targetWidth, int levels, int corridor, CarveStats *stats)
+{
+	if (targetWidth >= img.cols)
 	{
-		util::ShowWindow(ALL_SEAMS_W, true);
-		cv::imshow(ALL_SEAMS, allSeams);
-		winManager.ASWin = true;
+		std::cerr << "Target width is " << targetWidth << " but image width is " << img.cols << nl;
+		return;
 	}
-	else
+
+	int factor = 1 << std::clamp(levels, 1, 2);
+
+	// too small to downscale, the corridor would cover the whole image anyway
+	if (img.cols < factor * 4 || img.rows < factor * 4)
 	{
-		if (winManager.ASWin)
+		VerticalSeamCarvingDP(img, targetWidth, stats);
+		return;
+	}
+
+	// the upsampled seam can jump a whole coarse pixel between rows, so the corridor has to cover it
+	int radius = corridor + factor;
+
+	prof::BeginStage(prof::ENERGY);
+	std::vector<cv::Mat> channels;
+	cv::split(img, channels);
+	cv::Mat energyMap = CalculateEnergyMap(channels);
+
+	cv::Mat coarse;
+	cv::resize(img, coarse, cv::Size((img.cols + factor - 1) / factor, (img.rows + factor - 1) / factor), 0, 0, cv::INTER_AREA);
+	cv::split(coarse, channels);
+	cv::Mat coarseEnergyMap = CalculateEnergyMap(channels);
+	prof::EndStage(prof::ENERGY, img.total() + coarse.total());
+
+	std::vector<int> coarseSeam;
+	int pending = 0; // full resolution seams taken from around the current coarse seam
+
+	CarveBuffer buffer(img);
+
+	while (buffer.width > targetWidth)
+	{
+		cv::Mat view = buffer.View();
+
+		if (coarseSeam.empty())
 		{
-			util::ShowWindow(ALL_SEAMS_W, false);
-			winManager.ASWin = false;
+			prof::BeginStage(prof::CUM_MAP);
+			cv::Mat normEnergyMap;
+			cv::normalize(coarseEnergyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+			cv::Mat cumMap = CalculateVerticalCumMap(normEnergyMap);
+			prof::EndStage(prof::CUM_MAP, coarse.total());
+
+			prof::BeginStage(prof::FIND_SEAM);
+			coarseSeam = FindVerticalSeamDP(cumMap);
+			prof::EndStage(prof::FIND_SEAM, coarse.total());
+		}
+
+		prof::BeginStage(prof::FIND_SEAM);
+		// centre of the coarse pixel, the full resolution image has lost up to factor - 1 columns since
+		std::vector<int> path(view.rows);
+		for (int row{}; row < view.rows; ++row)
+			path[row] = std::min(view.cols - 1, coarseSeam[std::min(row / factor, coarse.rows - 1)] * factor + factor / 2);
+
+		std::vector<int> seam = FindVerticalSeamInCorridor(energyMap, path, radius);
+		prof::EndStage(prof::FIND_SEAM, static_cast<uint64_t>(view.rows) * (2 * radius + 1));
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += SumVerticalSeam(energyMap, seam);
+		}
+
+		VisualizeVerticalSeam(view, seam, cv::Vec3b(0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveVerticalSeam(seam, { &energyMap });
+		view = buffer.View();
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+
+		prof::BeginStage(prof::ENERGY);
+		UpdateVerticalEnergyMap(view, energyMap, seam);
+
+		// one coarse column stands for factor full resolution columns
+		if (++pending == factor && coarse.cols > 1)
+		{
+			RemoveVerticalSeam(coarse, coarseSeam, { &coarseEnergyMap });
+			UpdateVerticalEnergyMap(coarse, coarseEnergyMap, coarseSeam);
+			coarseSeam.clear();
+			pending = 0;
 		}
+		prof::EndStage(prof::ENERGY, static_cast<uint64_t>(view.rows) * 4);
+
+		if (isValidating)
+			ValidateEnergyUpdate(view, energyMap, seam, img.cols - buffer.width - 1, true);
 	}
 
-	cv::waitKey(waitFor);
+	img = buffer.Compact();
 }
 
-void VisualizeHorizontalSeam(cv::Mat& img, std::vector<int> const& seam, cv::Vec3b const& colour)
+void HorizontalSeamCarvingPyramid(cv::Mat &img, int targetHeight, int levels, int corridor, CarveStats *stats)
 {
+	if (targetHeight >= img.rows)
+	{
+		std::cerr << "Target height is " << targetHeight << " but image height is " << img.rows << nl;
+		return;
+	}
+
+	// the seams and the carved image would be shown transposed, so keep the windows closed
+	bool wasHeadless = isHeadless;
+	isHeadless = true;
+
+	cv::Mat transposed;
+	cv::transpose(img, transposed);
+	VerticalSeamCarvingPyramid(transposed, targetHeight, levels, corridor, stats);
+	cv::transpose(transposed, img);
+
+	isHeadless = wasHeadless;
+}
+
+// ===============
+// MULTI SEAM CARVING
+// ===============
+
+std::vector<std::vector<int>> FindVerticalSeamsDP(const cv::Mat &energyMap, int count)
+{
+	int rows = energyMap.rows, cols = energyMap.cols;
+	std::vector<std::vector<int>> seams;
+
+	if (!rows || !cols || count < 1)
+		return seams;
+
+	// a single seam is searched over the whole width, exactly like FindVerticalSeamDP
+	int strips = count == 1 ? 1 : std::min(2 * count, std::max(1, cols / 3));
+	count = std::min(count, strips);
+
+	std::vector<int> stripOf(cols);
+	std::vector<int> stripStart(strips + 1);
+	for (int strip{}; strip <= strips; ++strip)
+		stripStart[strip] = static_cast<int>(static_cast<int64_t>(cols) * strip / strips);
+	for (int strip{}; strip < strips; ++strip)
+		std::fill(stripOf.begin() + stripStart[strip], stripOf.begin() + stripStart[strip + 1], strip);
+
+	// cumulative map where a path never leaves its strip
+	cv::Mat cumMap(energyMap.size(), CV_64F);
+	energyMap.row(rows - 1).copyTo(cumMap.row(rows - 1));
+
+	for (int i = rows - 2; i > -1; --i)
+	{
+		const double *energy = energyMap.ptr<double>(i);
+		const double *below = cumMap.ptr<double>(i + 1);
+		double *curr = cumMap.ptr<double>(i);
+
+		for (int j = 0; j < cols; ++j)
+		{
+			double leftVal = j && stripOf[j - 1] == stripOf[j] ? below[j - 1] : MAX;
+			double rightVal = j < cols - 1 && stripOf[j + 1] == stripOf[j] ? below[j + 1] : MAX;
+			curr[j] = energy[j] + std::min({ leftVal, below[j], rightVal });
+		}
+	}
+
+	// walk down from the cheapest start of every strip with the tie breaking of FindVerticalSeamDP
+	std::vector<std::pair<double, int>> starts(strips);
+	for (int strip{}; strip < strips; ++strip)
+	{
+		int col = stripStart[strip];
+		for (int j = col + 1; j < stripStart[strip + 1]; ++j)
+			col = cumMap.at<double>(0, j) < cumMap.at<double>(0, col) ? j : col;
+		starts[strip] = { cumMap.at<double>(0, col), col };
+	}
+
+	std::sort(starts.begin(), starts.end());
+	starts.resize(count);
+	std::sort(starts.begin(), starts.end(), [](const auto &a, const auto &b) { return a.second < b.second; });
+
+	for (const auto &start : starts)
+	{
+		std::vector<int> seam(rows);
+		int col = start.second;
+		seam[0] = col;
+
+		for (int i = 0; i < rows - 1; ++i)
+		{
+			const double *below = cumMap.ptr<double>(i + 1);
+			double leftVal = col && stripOf[col - 1] == stripOf[col] ? below[col - 1] : MAX;
+			double midVal = below[col];
+			double rightVal = col < cols - 1 && stripOf[col + 1] == stripOf[col] ? below[col + 1] : MAX;
+			seam[i + 1] = col += PickSeamStep(leftVal, midVal, rightVal);
+		}
+
+		seams.push_back(std::move(seam));
+	}
+
+	return seams;
+}
+
+void RemoveVerticalSeams(cv::Mat &img, std::vector<std::vector<int>> const &seams)
+{
+	int rows = img.rows;
+	int cols = img.cols;
+	int count = static_cast<int>(seams.size());
+
+	if (!count)
+		return;
+
+	// shift every run between two seams left by the number of seams already passed, rows are independent
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+	{
+		size_t elemSize = img.elemSize();
+		for (int row = range.start; row < range.end; ++row)
+		{
+			uchar *data = img.ptr(row);
+			for (int i{}; i < count; ++i)
+			{
+				int begin = seams[i][row] + 1;
+				int end = i + 1 < count ? seams[i + 1][row] : cols;
+				std::memmove(data + (begin - i - 1) * elemSize, data + begin * elemSize, (end - begin) * elemSize);
+			}
+		}
+	});
+
+	img = img.colRange(0, cols - count);
+}
+
+void VerticalSeamCarvingMultiDP(cv::Mat &img, int targetWidth, int seamsPerPass, CarveStats *stats)
+{
+	if (targetWidth >= img.cols)
+	{
+		std::cerr << "Target width is " << targetWidth << " but image width is " << img.cols << nl;
+		return;
+	}
+
+	CarveBuffer buffer(img);
+
+	while (buffer.width > targetWidth)
+	{
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::ENERGY);
+		std::vector<cv::Mat> channels;
+		cv::split(view, channels);
+
+		cv::Mat energyMap = CalculateEnergyMap(channels), normEnergyMap;
+		cv::normalize(energyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+		prof::EndStage(prof::ENERGY, view.total());
+
+		prof::BeginStage(prof::FIND_SEAM);
+		int count = std::min(seamsPerPass, view.cols - targetWidth);
+		std::vector<std::vector<int>> seams = FindVerticalSeamsDP(normEnergyMap, count);
+		prof::EndStage(prof::FIND_SEAM, view.total());
+
+		if (isValidating)
+			ValidateSeamBatch(normEnergyMap, count, seams, img.cols - buffer.width);
+
+		for (std::vector<int> const &seam : seams)
+		{
+			if (stats)
+			{
+				++stats->seams;
+				stats->removedEnergy += SumVerticalSeam(energyMap, seam);
+			}
+
+			VisualizeVerticalSeam(view, seam, cv::Vec3b(0, 0, 255));
+		}
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		buffer.RemoveVerticalSeams(seams);
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+	}
+
+	img = buffer.Compact();
+}
+
+void HorizontalSeamCarvingMultiDP(cv::Mat &img, int targetHeight, int seamsPerPass, CarveStats *stats)
+{
+	if (targetHeight >= img.rows)
+	{
+		std::cerr << "Target height is " << targetHeight << " but image height is " << img.rows << nl;
+		return;
+	}
+
+	// the seams and the carved image would be shown transposed, so keep the windows closed
+	bool wasHeadless = isHeadless;
+	isHeadless = true;
+
+	cv::Mat transposed;
+	cv::transpose(img, transposed);
+	VerticalSeamCarvingMultiDP(transposed, targetHeight, seamsPerPass, stats);
+	cv::transpose(transposed, img);
+
+	isHeadless = wasHeadless;
+}
+
+// ===============
+// OPTIMAL ORDER
+// ===============
+
+std::vector<bool> FindSeamOrder(const cv::Mat &img, int targetWidth, int targetHeight, double maxMegapixels)
+{
+	int verticalSeams = std::max(0, img.cols - targetWidth);
+	int horizontalSeams = std::max(0, img.rows - targetHeight);
+
+	// the exact map keeps an image for every vertical seam count, the memory grows with the cube of the scale so the largest copy that fits is used instead
+	double exactMegabytes = (verticalSeams + 1.0) * static_cast<double>(img.total() * img.elemSize()) / (1024.0 * 1024.0);
+	if (maxMegapixels <= 0.0 && exactMegabytes > EXACT_ORDER_MAX_MEGABYTES)
+	{
+		maxMegapixels = static_cast<double>(img.total()) / 1e6 * std::pow(EXACT_ORDER_MAX_MEGABYTES / exactMegabytes, 2.0 / 3.0);
+		std::cerr << "The exact seam order needs " << exactMegabytes << " MB, deciding it on a copy of " << maxMegapixels << " megapixels instead" << nl;
+	}
+
+	// fill the transport map on a smaller copy, the seam counts shrink with the image
+	double scale = 1.0;
+	if (maxMegapixels > 0.0 && static_cast<double>(img.total()) > maxMegapixels * 1e6)
+		scale = std::sqrt(maxMegapixels * 1e6 / static_cast<double>(img.total()));
+
+	cv::Mat small = img;
+	if (scale < 1.0)
+		cv::resize(img, small, cv::Size(std::max(2, static_cast<int>(std::lround(img.cols * scale))), std::max(2, static_cast<int>(std::lround(img.rows * scale)))), 0, 0, cv::INTER_AREA);
+
+	int cols = std::min(verticalSeams, std::max(0, small.cols - 2));
+	int rows = std::min(horizontalSeams, std::max(0, small.rows - 2));
+	if (scale < 1.0)
+	{
+		cols = std::min(cols, static_cast<int>(std::lround(verticalSeams * scale)));
+		rows = std::min(rows, static_cast<int>(std::lround(horizontalSeams * scale)));
+	}
+
+	// the intermediate images are carved in place, so keep the windows closed
+	bool wasHeadless = isHeadless;
+	isHeadless = true;
+
+	auto findSeam = [](const cv::Mat &img, bool isVertical, double &cost)
+	{
+		std::vector<cv::Mat> channels;
+		cv::split(img, channels);
+		cv::Mat energyMap = CalculateEnergyMap(channels), normEnergyMap;
+		cv::normalize(energyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+
+		cv::Mat cumMap = isVertical ? CalculateVerticalCumMap(normEnergyMap) : CalculateHorizontalCumMap(normEnergyMap);
+		std::vector<int> seam = isVertical ? FindVerticalSeamDP(cumMap) : FindHorizontalSeamDP(cumMap);
+		cost = isVertical ? SumVerticalSeam(energyMap, seam) : SumHorizontalSeam(energyMap, seam);
+		return seam;
+	};
+
+	// transport map, cell (r, c) is reached after removing r horizontal and c vertical seams
+	std::vector<double> costs(static_cast<size_t>(rows + 1) * (cols + 1), 0.0);
+	std::vector<uchar> isFromLeft(costs.size(), 0);
+	auto at = [cols](int r, int c) { return static_cast<size_t>(r) * (cols + 1) + c; };
+
+	// a single row of images, images[c] still holds row r - 1 until cell (r, c) replaces it. every cell is filled before it is read,
+	// a horizontal step carves its buffer in place and a vertical step carves a copy of its left neighbour
+	std::vector<CarveBuffer> images(cols + 1, CarveBuffer(cv::Mat()));
+	for (int r{}; r <= rows; ++r)
+	{
+		for (int c{}; c <= cols; ++c)
+		{
+			if (!r && !c)
+			{
+				images[c] = CarveBuffer(small.clone());
+				continue;
+			}
+
+			double topCost = MAX, leftCost = MAX;
+			std::vector<int> topSeam, leftSeam;
+
+			if (r)
+			{
+				topSeam = findSeam(images[c].View(), false, topCost);
+				topCost += costs[at(r - 1, c)];
+			}
+
+			if (c)
+			{
+				leftSeam = findSeam(images[c - 1].View(), true, leftCost);
+				leftCost += costs[at(r, c - 1)];
+			}
+
+			if (leftCost < topCost)
+			{
+				costs[at(r, c)] = leftCost;
+				isFromLeft[at(r, c)] = 1;
+				images[c] = CarveBuffer(images[c - 1].View().clone());
+				images[c].RemoveVerticalSeam(leftSeam);
+			}
+			else
+			{
+				costs[at(r, c)] = topCost;
+				images[c].RemoveHorizontalSeam(topSeam);
+			}
+		}
+	}
+
+	isHeadless = wasHeadless;
+
+	// walk back from the target corner
+	std::vector<bool> smallOrder;
+	for (int r = rows, c = cols; r || c;)
+	{
+		bool isVertical = isFromLeft[at(r, c)];
+		smallOrder.push_back(isVertical);
+		isVertical ? --c : --r;
+	}
+	std::reverse(smallOrder.begin(), smallOrder.end());
+
+	// stretch the order to the full number of seams, keeping the same proportion of each direction at every step
+	std::vector<bool> order;
+	order.reserve(verticalSeams + horizontalSeams);
+	int smallVertical = 0, smallHorizontal = 0, vertical = 0, horizontal = 0;
+
+	for (bool isVertical : smallOrder)
+	{
+		isVertical ? ++smallVertical : ++smallHorizontal;
+
+		int verticalTarget = cols ? static_cast<int>(std::lround(static_cast<double>(smallVertical) * verticalSeams / cols)) : 0;
+		int horizontalTarget = rows ? static_cast<int>(std::lround(static_cast<double>(smallHorizontal) * horizontalSeams / rows)) : 0;
+
+		for (; vertical < verticalTarget; ++vertical)
+			order.push_back(true);
+		for (; horizontal < horizontalTarget; ++horizontal)
+			order.push_back(false);
+	}
+
+	// seams the small image could not represent are removed last
+	for (; vertical < verticalSeams; ++vertical)
+		order.push_back(true);
+	for (; horizontal < horizontalSeams; ++horizontal)
+		order.push_back(false);
+
+	return order;
+}
+
+void SeamCarvingOptimalOrder(cv::Mat &img, int targetWidth, int targetHeight, double maxMegapixels, CarveStats *stats)
+{
+	if (targetWidth > img.cols || targetHeight > img.rows || targetWidth < 2 || targetHeight < 2)
+	{
+		std::cerr << "Target size is " << targetWidth << "x" << targetHeight << " but image size is " << img.cols << "x" << img.rows << nl;
+		return;
+	}
+
+	std::vector<bool> order = FindSeamOrder(img, targetWidth, targetHeight, maxMegapixels);
+
+	// every seam is removed from the same buffer, carving one seam at a time through the drivers would copy the image per seam
+	CarveBuffer buffer(img);
+
+	for (bool isVertical : order)
+	{
+		cv::Mat view = buffer.View();
+
+		prof::BeginStage(prof::ENERGY);
+		std::vector<cv::Mat> channels;
+		cv::split(view, channels);
+
+		cv::Mat energyMap = CalculateEnergyMap(channels), normEnergyMap;
+		cv::normalize(energyMap, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+		prof::EndStage(prof::ENERGY, view.total());
+
+		prof::BeginStage(prof::CUM_MAP);
+		cv::Mat cumMap = isVertical ? CalculateVerticalCumMap(normEnergyMap) : CalculateHorizontalCumMap(normEnergyMap);
+		prof::EndStage(prof::CUM_MAP, view.total());
+
+		prof::BeginStage(prof::FIND_SEAM);
+		std::vector<int> seam = isVertical ? FindVerticalSeamDP(cumMap) : FindHorizontalSeamDP(cumMap);
+		prof::EndStage(prof::FIND_SEAM, view.total());
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += isVertical ? SumVerticalSeam(energyMap, seam) : SumHorizontalSeam(energyMap, seam);
+		}
+
+		if (isVertical)
+			VisualizeVerticalSeam(view, seam, cv::Vec3b(0, 0, 255));
+		else
+			VisualizeHorizontalSeam(view, seam, cv::Vec3b(0, 0, 255));
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		if (isVertical)
+			buffer.RemoveVerticalSeam(seam);
+		else
+			buffer.RemoveHorizontalSeam(seam);
+		prof::EndStage(prof::REMOVE_SEAM, view.total());
+	}
+
+	img = buffer.Compact();
+}
+
+// ===============
+// BIDIRECTIONAL DP
+// ===============
+
+std::vector<int> FindVerticalSeamBidirectional(const cv::Mat &energyMap)
+{
+	int rows = energyMap.rows, cols = energyMap.cols;
+
+	// too short to be worth splitting
+	if (rows < 4 || !cols)
+	{
+		cv::Mat cumMap = CalculateVerticalCumMap(energyMap);
+		return FindVerticalSeamDP(cumMap);
+	}
+
+	int mid = rows / 2;
+	cv::Mat down(mid, cols, CV_64F);      // rows 0 to mid - 1, cheapest path from the top row down to each pixel
+	cv::Mat up(rows - mid, cols, CV_64F); // rows mid to rows - 1, the rows of the serial cumulative map before normalisation
+	cv::Mat isOnSeam;                     // rows 0 to mid - 1, whether a pixel lies on any cheapest seam
+
+	// both halves run the row kernel of the serial map, the top half just walks the rows the other way
+	simd::CumRowKernel cumRow = simd::GetCumRowKernel();
+	cv::parallel_for_(cv::Range(0, 2), [&](const cv::Range &range)
+	{
+		for (int half = range.start; half < range.end; ++half)
+			if (half)
+			{
+				energyMap.row(0).copyTo(down.row(0));
+				for (int i = 1; i < mid; ++i)
+					cumRow(down.ptr<double>(i - 1), energyMap.ptr<double>(i), nullptr, down.ptr<double>(i), cols, 0.0);
+				isOnSeam = cv::Mat::zeros(mid, cols, CV_8U);
+			}
+			else
+			{
+				energyMap.row(rows - 1).copyTo(up.row(rows - 1 - mid));
+				for (int i = rows - 2; i >= mid; --i)
+					cumRow(up.ptr<double>(i + 1 - mid), energyMap.ptr<double>(i), nullptr, up.ptr<double>(i - mid), cols, 0.0);
+			}
+	}, 2);
+
+	// the cheapest seam joins a pixel of the middle row to the cheapest of the 3 below it
+	const double *above = down.ptr<double>(mid - 1), *below = up.ptr<double>(0);
+	std::vector<double> joined(cols);
+	double best = MAX;
+	for (int a = 0; a < cols; ++a)
+	{
+		joined[a] = above[a] + std::min({ a ? below[a - 1] : MAX, below[a], a < cols - 1 ? below[a + 1] : MAX });
+		best = std::min(best, joined[a]);
+	}
+
+	// mark every pixel of the top half that some cheapest seam runs through, from the middle row up. a pixel is on one when it is on
+	// one in the row below and the cheapest path down to that pixel can come from it, the marked columns only widen by one per row
+	int lo = cols, hi = -1;
+	for (int a = 0; a < cols; ++a)
+		if (joined[a] == best)
+		{
+			isOnSeam.at<uchar>(mid - 1, a) = 1;
+			lo = std::min(lo, a), hi = std::max(hi, a);
+		}
+
+	for (int i = mid - 1; i > 0; --i)
+	{
+		const double *prev = down.ptr<double>(i - 1), *curr = down.ptr<double>(i), *energy = energyMap.ptr<double>(i);
+		const uchar *marks = isOnSeam.ptr<uchar>(i);
+		uchar *prevMarks = isOnSeam.ptr<uchar>(i - 1);
+		int prevLo = cols, prevHi = -1;
+
+		for (int a = lo; a <= hi; ++a)
+			if (marks[a])
+				for (int p = std::max(0, a - 1); p <= std::min(cols - 1, a + 1); ++p)
+					if (prev[p] + energy[a] == curr[a])
+					{
+						prevMarks[p] = 1;
+						prevLo = std::min(prevLo, p), prevHi = std::max(prevHi, p);
+					}
+
+		lo = prevLo, hi = prevHi;
+	}
+
+	// the serial walk takes the leftmost cheapest column of the top row and then the step PickSeamStep prefers among the ones
+	// that stay on a cheapest seam, which in the top half are the marked pixels the cheapest path down to them can come from
+	std::vector<int> seam(rows);
+	int col = lo;
+	seam[0] = col;
+
+	for (int i = 0; i < mid - 1; ++i)
+	{
+		const double *curr = down.ptr<double>(i), *next = down.ptr<double>(i + 1), *energy = energyMap.ptr<double>(i + 1);
+		const uchar *marks = isOnSeam.ptr<uchar>(i + 1);
+		auto isCheapest = [&](int j) { return j >= 0 && j < cols && marks[j] && curr[col] + energy[j] == next[j]; };
+
+		// middle, then left, then right, like PickSeamStep on the serial map
+		seam[i + 1] = col += isCheapest(col) ? 0 : isCheapest(col - 1) ? -1 : 1;
+	}
+
+	// from the middle row down the serial map is the bottom up table itself
+	for (int i = mid - 1; i < rows - 1; ++i)
+	{
+		const double *next = up.ptr<double>(i + 1 - mid);
+		double leftVal = col ? next[col - 1] : MAX;
+		double midVal = next[col];
+		double rightVal = col < cols - 1 ? next[col + 1] : MAX;
+		seam[i + 1] = col += PickSeamStep(leftVal, midVal, rightVal);
+	}
+
+	return seam;
+}
+
+// ===============
+// SEAM INSERTION
+// ===============
+
+std::vector<std::vector<int>> FindVerticalSeamsForInsertion(const cv::Mat &img, int count, CarveStats *stats, const cv::Mat &energyMap)
+{
+	std::vector<std::vector<int>> seams;
+	count = std::min(count, img.cols - 1);
+
+	// the copy is carved in place, so keep the windows closed
+	bool wasHeadless = isHeadless;
+	isHeadless = true;
+
+	// original column of every pixel left in the carved copy
+	std::vector<std::vector<int>> originalCols(img.rows, std::vector<int>(img.cols));
+	for (std::vector<int> &cols : originalCols)
+		std::iota(cols.begin(), cols.end(), 0);
+
+	// the energy map is calculated once and only updated next to every removed seam
+	cv::Mat energy;
+	if (energyMap.size() == img.size())
+		energy = energyMap.clone();
+	else
+	{
+		std::vector<cv::Mat> channels;
+		cv::split(img, channels);
+		energy = CalculateEnergyMap(channels);
+	}
+
+	CarveBuffer buffer(img.clone());
+	for (int i{}; i < count; ++i)
+	{
+		cv::Mat normEnergyMap;
+		cv::normalize(energy, normEnergyMap, 0, 255, cv::NORM_MINMAX);
+		cv::Mat cumMap = CalculateVerticalCumMap(normEnergyMap);
+		std::vector<int> seam = FindVerticalSeamDP(cumMap);
+
+		if (stats)
+		{
+			++stats->seams;
+			stats->removedEnergy += SumVerticalSeam(energy, seam);
+		}
+
+		std::vector<int> original(buffer.height);
+		for (int row{}; row < buffer.height; ++row)
+		{
+			original[row] = originalCols[row][seam[row]];
+			originalCols[row].erase(originalCols[row].begin() + seam[row]);
+		}
+
+		seams.push_back(std::move(original));
+		buffer.RemoveVerticalSeam(seam, { &energy });
+		UpdateVerticalEnergyMap(buffer.View(), energy, seam);
+
+		if (isValidating)
+			ValidateEnergyUpdate(buffer.View(), energy, seam, i, true);
+	}
+
+	isHeadless = wasHeadless;
+	return seams;
+}
+
+void InsertVerticalSeams(cv::Mat &img, std::vector<std::vector<int>> const &seams)
+{
+	int rows = img.rows;
+	int cols = img.cols;
+	int count = static_cast<int>(seams.size());
+
+	if (!count)
+		return;
+
+	cv::Mat enlarged(rows, cols + count, img.type());
+	std::vector<int> positions(count);
+
+	for (int row{}; row < rows; ++row)
+	{
+		for (int i{}; i < count; ++i)
+			positions[i] = seams[i][row];
+		std::sort(positions.begin(), positions.end());
+
+		const cv::Vec3b *src = img.ptr<cv::Vec3b>(row);
+		cv::Vec3b *dst = enlarged.ptr<cv::Vec3b>(row);
+		int next = 0;
+
+		for (int col{}; col < cols; ++col)
+		{
+			*dst++ = src[col];
+
+			// seams never share a pixel, so at most one is inserted after each column
+			if (next < count && positions[next] == col)
+			{
+				const cv::Vec3b &right = src[std::min(col + 1, cols - 1)];
+				*dst++ = cv::Vec3b((src[col][0] + right[0] + 1) / 2, (src[col][1] + right[1] + 1) / 2, (src[col][2] + right[2] + 1) / 2);
+				++next;
+			}
+		}
+	}
+
+	img = enlarged;
+}
+
+void VerticalSeamInsertion(cv::Mat &img, int targetWidth, CarveStats *stats, const cv::Mat &energyMap)
+{
+	if (targetWidth <= img.cols)
+	{
+		std::cerr << "Target width is " << targetWidth << " but image width is " << img.cols << nl;
+		return;
+	}
+
+	while (img.cols < targetWidth)
+	{
+		int count = std::min(targetWidth - img.cols, std::max(1, img.cols / 2));
+
+		prof::BeginStage(prof::FIND_SEAM);
+		// the known energy map only matches the image before the first batch is inserted
+		std::vector<std::vector<int>> seams = FindVerticalSeamsForInsertion(img, count, stats, energyMap.size() == img.size() ? energyMap : cv::Mat());
+		prof::EndStage(prof::FIND_SEAM, img.total() * count);
+
+		prof::BeginStage(prof::REMOVE_SEAM);
+		InsertVerticalSeams(img, seams);
+		prof::EndStage(prof::REMOVE_SEAM, img.total());
+	}
+
+	if (!isHeadless)
+		cv::imshow(CARVED_IMAGE, img);
+}
+
+void HorizontalSeamInsertion(cv::Mat &img, int targetHeight, CarveStats *stats, const cv::Mat &energyMap)
+{
+	if (targetHeight <= img.rows)
+	{
+		std::cerr << "Target height is " << targetHeight << " but image height is " << img.rows << nl;
+		return;
+	}
+
+	// the seams would be drawn transposed, so keep the windows closed until the end
+	bool wasHeadless = isHeadless;
+	isHeadless = true;
+
+	cv::Mat transposed, transposedEnergyMap;
+	cv::transpose(img, transposed);
+	if (!energyMap.empty())
+		cv::transpose(energyMap, transposedEnergyMap);
+	VerticalSeamInsertion(transposed, targetHeight, stats, transposedEnergyMap);
+	cv::transpose(transposed, img);
+
+	isHeadless = wasHeadless;
+	if (!isHeadless)
+		cv::imshow(CARVED_IMAGE, img);
+}
+
+// ===============
+// REFERENCE BACKEND
+// ===============
+
+cv::Mat ReferenceEnergyMap(const cv::Mat &img)
+{
+	std::vector<cv::Mat> channels;
+	cv::split(img, channels);
+
+	cv::Mat gradX, gradY;
+	cv::Mat energyMap = cv::Mat::zeros(img.size(), CV_64F);
+
+	for (const cv::Mat &channel : channels)
+	{
+		cv::Sobel(channel, gradX, CV_64F, 1, 0, 3);
+		cv::Sobel(channel, gradY, CV_64F, 0, 1, 3);
+
+		energyMap += cv::abs(gradX) + cv::abs(gradY);
+	}
+
+	return energyMap;
+}
+
+cv::Mat ReferenceVerticalCumMap(const cv::Mat &energyMap, const cv::Mat &biasMap)
+{
+	cv::Mat cumMap(energyMap.size(), CV_64F);
+	int rows = energyMap.rows, cols = energyMap.cols;
+	bool hasBias = !biasMap.empty();
+	double max = 0.0;
+
+	if (!rows || !cols)
+		return cumMap;
+
+	for (int j = 0; j < cols; ++j)
+		cumMap.at<double>(rows - 1, j) = energyMap.at<double>(rows - 1, j) + (hasBias ? biasMap.at<double>(rows - 1, j) : 0.0);
+
+	// every pixel adds the lowest of the 3 sums below it, the maximum is taken over every row but the last
+	for (int i = rows - 2; i > -1; --i)
+		for (int j = 0; j < cols; ++j)
+		{
+			double leftVal = j ? cumMap.at<double>(i + 1, j - 1) : MAX;
+			double midVal = cumMap.at<double>(i + 1, j);
+			double rightVal = j < cols - 1 ? cumMap.at<double>(i + 1, j + 1) : MAX;
+
+			double &currVal = cumMap.at<double>(i, j);
+			currVal = energyMap.at<double>(i, j) + (hasBias ? biasMap.at<double>(i, j) : 0.0) + std::min({ leftVal, midVal, rightVal });
+			max = currVal > max ? currVal : max;
+		}
+
+	if (max > 0.0)
+		for (int i = 0; i < rows; ++i)
+			for (int j = 0; j < cols; ++j)
+				cumMap.at<double>(i, j) = cumMap.at<double>(i, j) / max * 255.0;
+
+	return cumMap;
+}
+
+std::vector<int> ReferenceVerticalSeam(const cv::Mat &cumMap)
+{
+	int rows = cumMap.rows, cols = cumMap.cols;
+	std::vector<int> seam(rows);
+
+	if (!rows || !cols)
+		return seam;
+
+	// the leftmost of the lowest sums in the first row
+	int col = 0;
+	for (int j = 1; j < cols; ++j)
+		if (cumMap.at<double>(0, j) < cumMap.at<double>(0, col))
+			col = j;
+	seam[0] = col;
+
+	// the lowest of the 3 pixels below, on a tie the middle one and then the left one
+	for (int i = 1; i < rows; ++i)
+	{
+		int best = col;
+		if (col > 0 && cumMap.at<double>(i, col - 1) < cumMap.at<double>(i, best))
+			best = col - 1;
+		if (col < cols - 1 && cumMap.at<double>(i, col + 1) < cumMap.at<double>(i, best))
+			best = col + 1;
+		seam[i] = col = best;
+	}
+
+	return seam;
+}
+
+std::vector<std::vector<int>> ReferenceVerticalSeams(const cv::Mat &energyMap, int count)
+{
+	int rows = energyMap.rows, cols = energyMap.cols;
+	std::vector<std::vector<int>> seams;
+
+	if (!rows || !cols || count < 1)
+		return seams;
+
+	// the strips of FindVerticalSeamsDP, every one is searched as an image of its own
+	int strips = count == 1 ? 1 : std::min(2 * count, std::max(1, cols / 3));
+	count = std::min(count, strips);
+
+	std::vector<std::pair<double, std::vector<int>>> candidates;
+	for (int strip = 0; strip < strips; ++strip)
+	{
+		int start = static_cast<int>(static_cast<int64_t>(cols) * strip / strips);
+		int end = static_cast<int>(static_cast<int64_t>(cols) * (strip + 1) / strips);
+		cv::Mat energy = energyMap.colRange(start, end);
+		cv::Mat cumMap(energy.size(), CV_64F);
+
+		// the sums are not normalised, the seams are picked by their total energy
+		for (int j = 0; j < energy.cols; ++j)
+			cumMap.at<double>(rows - 1, j) = energy.at<double>(rows - 1, j);
+
+		for (int i = rows - 2; i > -1; --i)
+			for (int j = 0; j < energy.cols; ++j)
+			{
+				double leftVal = j ? cumMap.at<double>(i + 1, j - 1) : MAX;
+				double midVal = cumMap.at<double>(i + 1, j);
+				double rightVal = j < energy.cols - 1 ? cumMap.at<double>(i + 1, j + 1) : MAX;
+				cumMap.at<double>(i, j) = energy.at<double>(i, j) + std::min({ leftVal, midVal, rightVal });
+			}
+
+		std::vector<int> seam = ReferenceVerticalSeam(cumMap);
+		double cost = cumMap.at<double>(0, seam[0]);
+		for (int &col : seam)
+			col += start;
+		candidates.push_back({ cost, std::move(seam) });
+	}
+
+	// the cheapest strips, the left one first on a tie, returned from left to right
+	std::stable_sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	candidates.resize(count);
+	std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.second[0] < b.second[0]; });
+
+	for (auto &candidate : candidates)
+		seams.push_back(std::move(candidate.second));
+	return seams;
+}
+
+cv::Mat ReferenceRemoveSeam(const cv::Mat &img, std::vector<int> const &seam, bool isVertical)
+{
+	if (!isVertical)
+		return ReferenceRemoveSeam(img.t(), seam, true).t();
+
+	cv::Mat carved(img.rows, img.cols - 1, img.type());
+	for (int i = 0; i < img.rows; ++i)
+	{
+		img.row(i).colRange(0, seam[i]).copyTo(carved.row(i).colRange(0, seam[i]));
+		img.row(i).colRange(seam[i] + 1, img.cols).copyTo(carved.row(i).colRange(seam[i], carved.cols));
+	}
+	return carved;
+}
+
+namespace
+{
+	// the two directions of a speculative object removal validate on their own threads
+	std::mutex divergenceMutex;
+
+	void ReportDivergence(const Divergence &divergence)
+	{
+		std::lock_guard<std::mutex> lock(divergenceMutex);
+		if (firstDivergence)
+			return;
+
+		firstDivergence = divergence;
+		std::cerr << std::setprecision(17) << "Validation: " << divergence.kernel << " diverged from the reference on seam " << divergence.seam;
+		if (divergence.row < 0)
+			std::cerr << ", " << divergence.optimised << " columns against " << divergence.reference << nl;
+		else
+			std::cerr << " at row " << divergence.row << ", col " << divergence.col << ": " << divergence.optimised << " against " << divergence.reference << nl;
+		std::cerr << std::setprecision(6);
+	}
+
+	// compares element by element in row major order, every channel of a pixel is compared as its own value
+	bool CompareWithReference(const std::string &kernel, const cv::Mat &optimised, const cv::Mat &reference, int seamIndex, double tolerance)
+	{
+		if (optimised.size() != reference.size() || optimised.type() != reference.type())
+		{
+			ReportDivergence({ kernel, seamIndex, -1, -1, static_cast<double>(optimised.cols), static_cast<double>(reference.cols) });
+			return false;
+		}
+
+		cv::Mat a, b;
+		optimised.reshape(1).convertTo(a, CV_64F);
+		reference.reshape(1).convertTo(b, CV_64F);
+
+		for (int i = 0; i < a.rows; ++i)
+		{
+			const double *lhs = a.ptr<double>(i), *rhs = b.ptr<double>(i);
+			for (int j = 0; j < a.cols; ++j)
+				if (std::abs(lhs[j] - rhs[j]) > tolerance * std::max(1.0, std::abs(rhs[j])))
+				{
+					ReportDivergence({ kernel, seamIndex, i, j / optimised.channels(), lhs[j], rhs[j] });
+					return false;
+				}
+		}
+		return true;
+	}
+
+	// seams are compared exactly, a divergence is reported at the pixel the optimised seam took
+	bool CompareSeams(const std::string &kernel, std::vector<int> const &seam, std::vector<int> const &reference, int seamIndex, bool isVertical)
+	{
+		if (seam.size() != reference.size())
+		{
+			ReportDivergence({ kernel, seamIndex, -1, -1, static_cast<double>(seam.size()), static_cast<double>(reference.size()) });
+			return false;
+		}
+
+		for (int i = 0; i < static_cast<int>(seam.size()); ++i)
+			if (seam[i] != reference[i])
+			{
+				ReportDivergence({ kernel, seamIndex, isVertical ? i : seam[i], isVertical ? seam[i] : i, static_cast<double>(seam[i]), static_cast<double>(reference[i]) });
+				return false;
+			}
+
+		return true;
+	}
+}
+
+bool ValidateSeamKernels(const cv::Mat &img, const cv::Mat &energyMap, const cv::Mat &normEnergyMap, const cv::Mat &biasMap,
+	const cv::Mat &cumMap, std::vector<int> const &seam, int seamIndex, bool isVertical)
+{
+	// a horizontal seam is a vertical seam of the transposed maps
+	auto along = [isVertical](const cv::Mat &mat) { return isVertical || mat.empty() ? mat : cv::Mat(mat.t()); };
+
+	bool isMatch = true;
+	if (!energyMap.empty())
+		isMatch &= CompareWithReference("CalculateEnergyMap", energyMap, along(ReferenceEnergyMap(along(img))), seamIndex, VALIDATION_TOLERANCE);
+
+	isMatch &= CompareWithReference(isVertical ? "CalculateVerticalCumMap" : "CalculateHorizontalCumMap",
+		cumMap, along(ReferenceVerticalCumMap(along(normEnergyMap), along(biasMap))), seamIndex, VALIDATION_TOLERANCE);
+
+	isMatch &= CompareSeams(isVertical ? "FindVerticalSeamDP" : "FindHorizontalSeamDP", seam, ReferenceVerticalSeam(along(cumMap)), seamIndex, isVertical);
+	return isMatch;
+}
+
+bool ValidateBidirectionalSeam(const cv::Mat &img, const cv::Mat &energyMap, const cv::Mat &rawEnergyMap, std::vector<int> const &seam,
+	int seamIndex, bool isVertical)
+{
+	auto along = [isVertical](const cv::Mat &mat) { return isVertical || mat.empty() ? mat : cv::Mat(mat.t()); };
+
+	bool isMatch = true;
+	if (!energyMap.empty())
+		isMatch &= CompareWithReference("CalculateEnergyMap", energyMap, along(ReferenceEnergyMap(along(img))), seamIndex, VALIDATION_TOLERANCE);
+
+	// the serial search on the normalised map has to pick the very same seam, ties included
+	cv::Mat cumMap = CalculateVerticalCumMap(along(rawEnergyMap));
+	isMatch &= CompareSeams("FindVerticalSeamBidirectional", seam, FindVerticalSeamDP(cumMap), seamIndex, isVertical);
+	return isMatch;
+}
+
+bool ValidateSeamBatch(const cv::Mat &energyMap, int count, std::vector<std::vector<int>> const &seams, int seamIndex)
+{
+	std::vector<std::vector<int>> reference = ReferenceVerticalSeams(energyMap, count);
+	if (seams.size() != reference.size())
+	{
+		ReportDivergence({ "FindVerticalSeamsDP", seamIndex, -1, -1, static_cast<double>(seams.size()), static_cast<double>(reference.size()) });
+		return false;
+	}
+
+	for (size_t k{}; k < seams.size(); ++k)
+		if (!CompareSeams("FindVerticalSeamsDP", seams[k], reference[k], seamIndex + static_cast<int>(k), true))
+			return false;
+	return true;
+}
+
+bool ValidateEnergyUpdate(const cv::Mat &img, const cv::Mat &energyMap, std::vector<int> const &seam, int seamIndex, bool isVertical)
+{
+	cv::Mat reference = ReferenceEnergyMap(img);
+	int length = isVertical ? img.cols : img.rows;
+
+	// the pixels next to the seam were recalculated one at a time, they are checked before the map as a whole
+	for (int i = 0; i < static_cast<int>(seam.size()); ++i)
+		for (int k = std::max(0, seam[i] - 2); k <= std::min(length - 1, seam[i] + 1); ++k)
+		{
+			int row = isVertical ? i : k, col = isVertical ? k : i;
+			double optimised = CalculatePixelEnergy(img, row, col), expected = reference.at<double>(row, col);
+
+			if (std::abs(optimised - expected) > VALIDATION_TOLERANCE * std::max(1.0, std::abs(expected)))
+			{
+				ReportDivergence({ "CalculatePixelEnergy", seamIndex, row, col, optimised, expected });
+				return false;
+			}
+		}
+
+	return CompareWithReference(isVertical ? "UpdateVerticalEnergyMap" : "UpdateHorizontalEnergyMap", energyMap, reference, seamIndex, VALIDATION_TOLERANCE);
+}
+
+bool ValidateSeamRemoval(const cv::Mat &expected, const cv::Mat &carved, int seamIndex)
+{
+	return CompareWithReference("RemoveSeam", carved, expected, seamIndex, 0.0);
+}
+
+// ===============
+// VISUALIZATION
+// ===============
+
+void VisualizeVerticalSeam(cv::Mat& img, std::vector<int> const& seam, cv::Vec3b const& colour)
+{
+	if (isHeadless)
+		return;
+
+	// assign colour to the seam for visualization
+	for (int i{}; i < img.rows; ++i)
+	{
+		img.at<cv::Vec3b>(i, seam[i]) = colour;
+		allSeams.at<cv::Vec3b>(i, seam[i]) = colour;
+	}
+
+	if (editor.GetWindow<edit::WindowsManager>()->shldOpenCarvedImage)
+	{
+		util::ShowWindow(CARVED_IMAGE_W, true);
+		cv::imshow(CARVED_IMAGE, img);
+		winManager.CIWin = true;
+	}
+	else
+	{
+		if (winManager.CIWin)
+		{
+			util::ShowWindow(CARVED_IMAGE_W, false);
+			winManager.CIWin = false;
+		}
+	}
+
+	if (editor.GetWindow<edit::WindowsManager>()->shldOpenAllSeams)
+	{
+		util::ShowWindow(ALL_SEAMS_W, true);
+		cv::imshow(ALL_SEAMS, allSeams);
+		winManager.ASWin = true;
+	}
+	else
+	{
+		if (winManager.ASWin)
+		{
+			util::ShowWindow(ALL_SEAMS_W, false);
+			winManager.ASWin = false;
+		}
+	}
+
+	cv::waitKey(waitFor);
+}
+
+void VisualizeHorizontalSeam(cv::Mat& img, std::vector<int> const& seam, cv::Vec3b const& colour)
+{
+	if (isHeadless)
+		return;
+
 	// assign colour to the seam for visualization
 	for (int i{}; i < img.cols; ++i)
 	{
@@ -29,6 +29,10 @@
 #ifndef SEAMCARVING_H
 #define SEAMCARVING_H
 
+#include <array>
+#include <atomic>
+#include <optional>
+
 // open cv lib
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
@@ -39,58 +43,271 @@
 // utility functions
 #include "Utility.h"
 
+/**
+ * @brief Ways a deadline bounded carve can remove seams, from the most to the least exact.
+ */
+enum CarveStrategy
+{
+	EXACT_DP,          // recompute the energy and cumulative map for every seam
+	STALE_ENERGY,      // recompute the energy every few seams and shrink it in between
+	DOWNSCALED_SEARCH, // find the seam on a half resolution image, scale it back up and refine it 1 column either side
+	PLAIN_RESIZE,      // cv::resize the remaining seams away in one step
+	MAX_STRATEGY
+};
+
+inline const std::array<const char *, MAX_STRATEGY> STRATEGY_NAMES =
+{
+	"Exact DP",
+	"Stale energy",
+	"Downscaled search",
+	"Plain resize"
+};
+
+/**
+ * @brief Statistics collected by the carving drivers when a pointer to it is passed in.
+ */
+struct CarveStats
+{
+	int seams = 0;              // number of seams removed
+	double removedEnergy = 0.0; // sum of the unnormalised energy of every removed pixel
+	double staleEnergy = 0.0;   // the same sum according to the energy map the seams were found on, differs when that map is stale
+	double elapsedMs = 0.0;     // wall time of the carve, only filled by the deadline drivers
+	std::array<int, MAX_STRATEGY> strategySeams{}; // seams removed by each strategy, only filled by the deadline drivers
+};
+
+/**
+ * @brief Owned working buffer the carving drivers remove seams from.
+ *
+ * Removing a seam only shifts pixels inside the buffer and shrinks its logical size, the row
+ * stride stays that of the original allocation so no seam reallocates or copies the image.
+ * The carved image is copied out once, by Compact, when the driver is done.
+ */
+class CarveBuffer
+{
+	cv::Mat storage;
+
+public:
+
+	int width = 0, height = 0; // logical size of the carved image
+
+	/**
+	 * @brief Takes over the pixels of an image, they are only copied if the image is not continuous.
+	 *
+	 * @param img The image to carve, its pixels are shifted in place.
+	 */
+	explicit CarveBuffer(const cv::Mat &img);
+
+	/**
+	 * @brief Gets the carved image as a view into the buffer, valid until the next removal.
+	 */
+	cv::Mat View() const;
+
+	/**
+	 * @brief Gets the distance in bytes between two rows of the buffer.
+	 */
+	size_t Stride() const;
+
+	/**
+	 * @brief Removes a vertical seam from the buffer and from the planes carved along with it.
+	 *
+	 * @param seam The column of the seam on every row.
+	 * @param planes Extra single image planes to remove the seam from, null entries are skipped.
+	 */
+	void RemoveVerticalSeam(std::vector<int> const &seam, std::vector<cv::Mat *> const &planes = {});
+
+	/**
+	 * @brief Removes a horizontal seam from the buffer and from the planes carved along with it.
+	 *
+	 * @param seam The row of the seam on every column.
+	 * @param planes Extra single image planes to remove the seam from, null entries are skipped.
+	 */
+	void RemoveHorizontalSeam(std::vector<int> const &seam, std::vector<cv::Mat *> const &planes = {});
+
+	/**
+	 * @brief Removes several non-crossing vertical seams from the buffer at once.
+	 *
+	 * @param seams The seams, ordered left to right on every row.
+	 */
+	void RemoveVerticalSeams(std::vector<std::vector<int>> const &seams);
+
+	/**
+	 * @brief Copies the carved image out of the buffer into its own continuous allocation.
+	 */
+	cv::Mat Compact() const;
+};
+
+/**
+ * @brief Gets the columns vertical seams, or the rows horizontal seams, are confined to by a region of interest.
+ *
+ * A seam has to cross the whole image, so a vertical seam stays within the columns of the ROI on every row and
+ * a horizontal seam within its rows on every column. Only that band is carved, the energy and the cumulative
+ * map are calculated on it as if it were the whole image, and everything outside it is left pixel exact.
+ *
+ * @param roi The region of interest, empty for the whole image.
+ * @param size The size of the image to carve.
+ * @param isVertical Whether the band is for vertical seams.
+ * @return cv::Range The columns (rows for horizontal seams) of roi clipped to the image, all of them when roi is empty.
+ */
+cv::Range GetSeamBand(const cv::Rect &roi, cv::Size size, bool isVertical);
+
 
 // =============
 // OBJECT REMOVAL
 // =============
 
+// spans of the painted pixels of brushMask, kept in step with it by the brush
+inline util::SpanMask brushSpans;
+
+/**
+ * @brief Adds a span to a row or column of a span mask, merging it with the spans it overlaps or touches.
+ *
+ * @param line The spans of the row or column, sorted by start.
+ * @param start The first masked pixel.
+ * @param size The number of masked pixels.
+ */
+void AddSpan(std::vector<util::Span> &line, int start, int size);
+
 /**
- * @brief Generates a collection of masks representing the bounded area between two points in a 2D grid.
+ * @brief Adds a filled circle of the brush to a span mask without scanning the mask image.
  *
- * @param start The starting point of the bounded area (cv::Point2i).
- * @param end The ending point of the bounded area (cv::Point2i).
- * @return std::vector<util::Mask> A vector of masks representing the bounded area.
+ * @param spans The span mask, resized to the image if it is not already.
+ * @param size The size of the image the brush paints on.
+ * @param centre The centre of the brush.
+ * @param radius The radius of the brush.
  */
-std::vector<util::Mask> GetBoundedArea(cv::Point2i start, cv::Point2i end);
+void AddBrushStroke(util::SpanMask &spans, cv::Size size, cv::Point centre, int radius);
 
+/**
+ * @brief Builds a span mask from the non-zero pixels of a mask image.
+ *
+ * @param mask A single channel mask image.
+ * @return util::SpanMask The spans of every row and every column.
+ */
+util::SpanMask MakeSpanMask(const cv::Mat &mask);
 
 /**
- * @brief Modifies a collection of masks by applying a specified seam to it.
+ * @brief Removes a seam from the spans it crosses, in time linear in the number of spans.
+ *
+ * Spans after the seam move back by one, a span the seam passes through loses one pixel.
  *
- * @param area A reference to the vector of masks representing the area to be modified.
- * @param seam A vector of integers representing the seam to apply.
- * @return true If the modification was successful.
- * @return false If the modification failed.
+ * @param lines The spans of every row for a vertical seam, or of every column for a horizontal seam.
+ * @param seam The removed seam, indexed by row for a vertical seam or by column for a horizontal seam.
+ * @return true If no span is wider than the threshold any more, so the object is gone.
  */
-bool ModifyMask(std::vector<util::Mask> &area, const std::vector<int> &seam);
+bool ModifyMask(std::vector<std::vector<util::Span>> &lines, const std::vector<int> &seam);
 
 
 /**
- * @brief Modifies the vertical energy map by applying a set value to a specific area.
+ * @brief Gets protectMask at the size of the image to carve.
+ *
+ * @param size The size of the image to carve. A protectMask painted before the image was enlarged is stretched to it
+ *             with nearest neighbour sampling.
+ * @return cv::Mat The mask, or an empty one when nothing is protected.
+ */
+cv::Mat GetProtectMask(cv::Size size);
+
+/**
+ * @brief Makes the bias map of the protected pixels, to be added to the energy inside the cumulative map.
+ *
+ * protection is in units of the unnormalised energy, the same scale MakeRemovalBiasMap uses, so a protected pixel
+ * costs as much to the DP drivers as it does to object removal. Only the single seam DP drivers and object removal
+ * honour it.
  *
- * @param energyMap A reference to the energy map matrix to modify (cv::Mat).
- * @param area The area (vector of masks) to modify within the energy map.
- * @param setTo The value to set within the specified area (default is 0.0).
+ * @param size The size of the image to carve, see GetProtectMask.
+ * @return cv::Mat A CV_64F map of protection on every pixel of protectMask and 0 elsewhere, or an empty map
+ *                 when nothing is protected.
  */
-void ModifyVerticalEnergyMap(cv::Mat &energyMap, const std::vector<util::Mask> &area, double setTo = 0.0);
+cv::Mat MakeProtectBiasMap(cv::Size size);
 
+// the largest energy CalculateEnergyMap gives a 3 channel 8 bit pixel, each Sobel gradient is at most 4 * 255 per channel
+inline const double MAX_PIXEL_ENERGY = 3 * 2 * 4 * 255.0;
 
 /**
- * @brief Modifies the horizontal energy map by applying a set value to a specific area.
+ * @brief Makes the bias map of object removal, -(MAX_PIXEL_ENERGY + min) on every pixel of brushMask and protection
+ *        on every pixel of protectMask.
  *
- * @param energyMap A reference to the energy map matrix to modify (cv::Mat).
- * @param area The area (vector of masks) to modify within the energy map.
- * @param setTo The value to set within the specified area (default is 0.0).
+ * The bias is added to the unnormalised energy, so a brushed pixel costs at most -min however textured it is and
+ * is always cheaper than any pixel that is not brushed.
+ *
+ * @param size The size of the image to carve, which brushMask has to match. protectMask is stretched to it like in
+ *             MakeProtectBiasMap.
+ */
+cv::Mat MakeRemovalBiasMap(cv::Size size);
+
+/**
+ * @brief Removes the brushed object with vertical seams.
+ *
+ * The energy map is calculated once and the brushed pixels are kept in a separate bias map, both are
+ * shrunk along with the image. After every seam only the energy next to it is recalculated and the bias
+ * is added inside the cumulative map, so the energy map stays exact without recalculating it.
+ * With a refresh interval above 1 the energy map is only shrunk in between and the whole band is
+ * recalculated every refreshInterval seams instead.
+ *
+ * @param img The image to remove the object from.
+ * @param biasMap The bias from MakeRemovalBiasMap, shrunk along with the image.
+ * @param rows The spans of the object on every row, relative to the start of the ROI band, shrunk as seams are removed.
+ * @param stats Optional statistics of the removed seams.
+ * @param refreshInterval The energy map is recalculated every this many seams and only shrunk in between, 1 keeps it exact.
+ * @param bestSeams Optional fewest seams another removal of the same object finished with, the removal gives up
+ *                  once it has used as many and lowers it when it finishes with fewer.
+ * @param finalEnergyMap Optional energy map of the carved ROI band, filled when the object was removed and the map is not stale.
+ * @param roi Optional region of interest the seams are confined to, see GetSeamBand.
+ * @return true If the object was removed, false if the removal gave up and left img partly carved.
+ */
+bool RemoveObjectVertical(cv::Mat &img, cv::Mat &biasMap, std::vector<std::vector<util::Span>> &rows, CarveStats *stats = nullptr, int refreshInterval = 1,
+	std::atomic<int> *bestSeams = nullptr, cv::Mat *finalEnergyMap = nullptr, const cv::Rect &roi = cv::Rect());
+
+/**
+ * @brief Removes the brushed object with horizontal seams, the same way as RemoveObjectVertical.
+ *
+ * @param img The image to remove the object from.
+ * @param biasMap The bias from MakeRemovalBiasMap, shrunk along with the image.
+ * @param cols The spans of the object on every column, relative to the start of the ROI band, shrunk as seams are removed.
+ * @param stats Optional statistics of the removed seams.
+ * @param refreshInterval The energy map is recalculated every this many seams and only shrunk in between, 1 keeps it exact.
+ * @param bestSeams Optional fewest seams another removal of the same object finished with.
+ * @param finalEnergyMap Optional energy map of the carved ROI band, filled when the object was removed and the map is not stale.
+ * @param roi Optional region of interest the seams are confined to, see GetSeamBand.
+ * @return true If the object was removed, false if the removal gave up and left img partly carved.
  */
-void ModifyHorizontalEnergyMap(cv::Mat &energyMap, const std::vector<util::Mask> &area, double setTo = 0.0);
+bool RemoveObjectHorizontal(cv::Mat &img, cv::Mat &biasMap, std::vector<std::vector<util::Span>> &cols, CarveStats *stats = nullptr, int refreshInterval = 1,
+	std::atomic<int> *bestSeams = nullptr, cv::Mat *finalEnergyMap = nullptr, const cv::Rect &roi = cv::Rect());
 
+/**
+ * @brief Removes objects that lie in separate strips of the image independently and in parallel.
+ *
+ * The connected components of brushMask are grouped by the columns they cover for vertical seams, or the rows
+ * for horizontal seams. When there is more than one group the image is cut halfway between neighbouring groups
+ * and every strip is carved on its own with strip local seams, so the removal takes as many seams in a row as
+ * the widest group instead of all of them. The strips are stitched back together afterwards.
+ *
+ * @param img The image to remove the objects from.
+ * @param biasMap The bias from MakeRemovalBiasMap, only read.
+ * @param isVertical Whether to remove the objects with vertical seams.
+ * @param stats Optional statistics of the removed seams of every strip.
+ * @param refreshInterval The energy map is recalculated every this many seams and only shrunk in between, 1 keeps it exact.
+ * @return true If the objects were removed, false if they do not fall into separate strips and img is unchanged.
+ */
+bool RemoveObjectsInStrips(cv::Mat &img, const cv::Mat &biasMap, bool isVertical, CarveStats *stats = nullptr, int refreshInterval = 1);
 
 /**
  * @brief Performs content-aware removal on an image.
  *
  * @param img A reference to the image to be processed (cv::Mat).
+ * @param stats Optional statistics of the removed seams.
+ * @param refreshInterval The energy map is recalculated every this many seams and only shrunk in between, 1 keeps it exact
+ *                        by recalculating the pixels next to every seam.
+ * @param isSpeculative Removes the object in both directions at once on separate threads and keeps the one
+ *                      that needed fewer seams, instead of guessing the direction from the shape of the brush.
+ *                      The slower direction stops as soon as it has used more seams than the finished one.
+ *                      Otherwise objects in separate strips are removed in parallel by RemoveObjectsInStrips.
+ * @param shldRestoreSize Inserts as many seams as were removed afterwards, in one batch, so the image keeps its size.
+ *                        The seam search starts from the energy map the removal already kept up to date.
+ * @param roi Optional region of interest the removal and insertion seams are confined to, see GetSeamBand. Brushed
+ *            pixels outside its band are left alone and objects are not split into parallel strips.
  */
-void ContentAwareRemoval(cv::Mat &img);
+void ContentAwareRemoval(cv::Mat &img, CarveStats *stats = nullptr, int refreshInterval = 1, bool isSpeculative = false, bool shldRestoreSize = false,
+	const cv::Rect &roi = cv::Rect());
 
 // =============
 // ENERGY MAP
@@ -114,16 +331,57 @@ cv::Mat CalculateEnergyMap(std::vector<cv::Mat> const &channels);
  */
 cv::Mat CalculateVerticalCumMap(const cv::Mat &energyMap);
 
+/**
+ * @brief Computes the vertical cumulative energy map of an energy map with a bias added to every pixel.
+ *
+ * @param energyMap A reference to the input energy map (cv::Mat).
+ * @param biasMap The weight added to the energy of every pixel, negative to remove and positive to protect.
+ * @return cv::Mat The vertical cumulative energy map of energyMap + biasMap.
+ */
+cv::Mat CalculateVerticalCumMap(const cv::Mat &energyMap, const cv::Mat &biasMap);
+
+
+// images at least this wide use CalculateVerticalCumMapTiled in VerticalSeamCarvingDP, a row of doubles no longer fits in L2
+inline const int TILED_CUM_MAP_MIN_COLS = 8192;
+
+/**
+ * @brief Computes exactly the same vertical cumulative energy map as CalculateVerticalCumMap, in cache sized tiles on every core.
+ *
+ * The rows are processed in blocks. Within a block every tile of columns also sums a halo of one extra column
+ * per row of the block on either side, so it never needs a neighbouring tile's results and the tiles of a block
+ * run in parallel. The halo shrinks by a column per row and only the tile's own columns are written out. Every
+ * row of a halo is summed by the same row kernel as CalculateVerticalCumMap.
+ *
+ * @param energyMap A reference to the input energy map (cv::Mat).
+ * @param tileCols The width of a tile in columns.
+ * @param blockRows The height of a block of rows, which is also the width of the halo.
+ * @return cv::Mat The vertical cumulative energy map, identical to CalculateVerticalCumMap.
+ */
+cv::Mat CalculateVerticalCumMapTiled(const cv::Mat &energyMap, int tileCols = 2048, int blockRows = 64);
+
 
 /**
  * @brief Computes the horizontal cumulative energy map from a given energy map.
  *
+ * Runs CalculateVerticalCumMap on the transposed energy map, so the columns are summed by the same row kernel.
+ *
  * @param energyMap A reference to the input energy map (cv::Mat).
  * @return cv::Mat The horizontal cumulative energy map, where each pixel contains the cumulative energy
  *                 value from the leftmost column to that pixel.
  */
 cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap);
 
+/**
+ * @brief Computes the horizontal cumulative energy map of an energy map with a bias added to every pixel.
+ *
+ * Runs on the transposed maps like CalculateHorizontalCumMap.
+ *
+ * @param energyMap A reference to the input energy map (cv::Mat).
+ * @param biasMap The weight added to the energy of every pixel, negative to remove and positive to protect.
+ * @return cv::Mat The horizontal cumulative energy map of energyMap + biasMap.
+ */
+cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap, const cv::Mat &biasMap);
+
 
 // =============
 // SEAM CARVING - VERTICAL
@@ -138,9 +396,27 @@ cv::Mat CalculateHorizontalCumMap(const cv::Mat &energyMap);
 std::vector<int> FindVerticalSeamGreedy(cv::Mat const &energyMap);
 
 
+/**
+ * @brief Picks the next step of a seam from the sums of the three pixels it can move to.
+ *
+ * Every seam finder traces with this rule, so their seams agree on ties: the lowest sum wins, preferring
+ * the middle pixel and then the left (upper) one when they are equal.
+ *
+ * @param leftVal The sum of the pixel to the left, or above for a horizontal seam, MAX when there is none.
+ * @param midVal The sum of the pixel straight ahead.
+ * @param rightVal The sum of the pixel to the right, or below for a horizontal seam, MAX when there is none.
+ * @return int The offset of the step, -1, 0 or 1.
+ */
+int PickSeamStep(double leftVal, double midVal, double rightVal);
+
+
 /**
  * @brief Finds a vertical seam in a cumulative energy map using dynamic programming.
  *
+ * Ties are broken the same way every time, so the reference backend can match the seam exactly: the seam
+ * starts at the leftmost of the lowest sums in the first row, and every step down takes the lowest of the
+ * three pixels below, preferring the middle one and then the left one when they are equal.
+ *
  * @param cumMap A reference to the cumulative energy map (cv::Mat) where the seam will be identified.
  *               This map is modified internally as part of the seam-finding process.
  * @return std::vector<int> A vector representing the vertical seam, where each element indicates the column index of the seam at a specific row.
@@ -157,13 +433,52 @@ std::vector<int> FindVerticalSeamDP(cv::Mat &cumMap);
 std::vector<int> FindVerticalSeamGraphCut(cv::Mat const& energyMap);
 
 
+/**
+ * @brief Sums the energy of the pixels on a vertical seam.
+ *
+ * @param energyMap The energy map the seam was found on (CV_64F).
+ * @param seam The column index of the seam at every row.
+ * @return double The total energy of the seam.
+ */
+double SumVerticalSeam(const cv::Mat &energyMap, std::vector<int> const &seam);
+
+
+/**
+ * @brief Sums the current energy of the pixels on a vertical seam, without needing an up to date energy map.
+ *
+ * @param img The image the seam will be removed from.
+ * @param seam The column index of the seam at every row.
+ * @return double The total energy of the seam, as SumVerticalSeam would give on a freshly calculated energy map.
+ */
+double CalculateVerticalSeamEnergy(const cv::Mat &img, std::vector<int> const &seam);
+
+
+/**
+ * @brief Removes a vertical seam from every plane in one pass, one thread per block of rows.
+ *
+ * @param planes Images or maps of the same size and any type, null pointers are skipped.
+ * @param seam The column index of the seam at a specific row.
+ */
+void RemoveVerticalSeamFromPlanes(std::vector<cv::Mat *> const &planes, std::vector<int> const &seam);
+
+
 /**
  * @brief Removes a vertical seam from an image.
  *
  * @param img A reference to the image (cv::Mat) from which the seam will be removed.
  * @param seam A constant reference to a vector representing the vertical seam to remove. Each element indicates the column index of the seam at a specific row.
+ * @param planes Auxiliary planes of the same size, such as the energy map, compacted in the same pass. Null pointers are skipped.
+ */
+void RemoveVerticalSeam(cv::Mat &img, std::vector<int> const &seam, std::vector<cv::Mat *> const &planes = {});
+
+
+/**
+ * @brief Removes a vertical seam from a single channel CV_64F map, such as an energy map that is reused between seams.
+ *
+ * @param map A reference to the map from which the seam will be removed.
+ * @param seam The column index of the seam at every row.
  */
-void RemoveVerticalSeam(cv::Mat &img, std::vector<int> const &seam);
+void RemoveVerticalSeamFromMap(cv::Mat &map, std::vector<int> const &seam);
 
 
 /**
@@ -171,8 +486,9 @@ void RemoveVerticalSeam(cv::Mat &img, std::vector<int> const &seam);
  *
  * @param img A reference to the input image (cv::Mat) to be resized.
  * @param targetWidth The desired width of the image after seam carving.
+ * @param stats Optional statistics of the removed seams.
  */
-void VerticalSeamCarvingGreedy(cv::Mat &img, int targetWidth);
+void VerticalSeamCarvingGreedy(cv::Mat &img, int targetWidth, CarveStats *stats = nullptr);
 
 
 /**
@@ -180,8 +496,16 @@ void VerticalSeamCarvingGreedy(cv::Mat &img, int targetWidth);
  *
  * @param img A reference to the input image (cv::Mat) to be resized.
  * @param targetWidth The desired width of the image after seam carving.
+ * @param stats Optional statistics of the removed seams, staleEnergy against removedEnergy shows how far a stale energy map drifted.
+ * @param refreshInterval The energy map is recalculated every this many seams and only shrunk in between, 1 recalculates it for every seam.
+ * @param biasMap Optional bias in units of the unnormalised energy, such as MakeProtectBiasMap. A biased carve builds the
+ *                cumulative map from the unnormalised energy plus the bias, an unbiased one from the energy normalised to 0-255.
+ *                It is shrunk along with the image, so it can be passed on to HorizontalSeamCarvingDP.
+ * @param roi Optional region of interest the seams are confined to, see GetSeamBand. The energy and cumulative maps
+ *            only cover its columns and the rest of every row is shifted with a single move per seam.
  */
-void VerticalSeamCarvingDP(cv::Mat &img, int targetWidth);
+void VerticalSeamCarvingDP(cv::Mat &img, int targetWidth, CarveStats *stats = nullptr, int refreshInterval = 1, cv::Mat *biasMap = nullptr,
+	const cv::Rect &roi = cv::Rect());
 
 
 /**
@@ -189,8 +513,9 @@ void VerticalSeamCarvingDP(cv::Mat &img, int targetWidth);
  *
  * @param img A reference to the input image (cv::Mat) to be resized.
  * @param targetWidth The desired width of the image after seam carving.
+ * @param stats Optional statistics of the removed seams.
  */
-void VerticalSeamCarvingGraphCut(cv::Mat& img, int targetWidth);
+void VerticalSeamCarvingGraphCut(cv::Mat& img, int targetWidth, CarveStats *stats = nullptr);
 
 // ===============
 // SEAM CARVING - HORIZONTAL
@@ -208,6 +533,9 @@ std::vector<int> FindHorizontalSeamGreedy(cv::Mat const &energyMap);
 /**
  * @brief Finds a horizontal seam in a cumulative energy map using dynamic programming.
  *
+ * Breaks ties like FindVerticalSeamDP with rows and columns swapped, the topmost start and then the middle,
+ * the upper and the lower pixel of every step.
+ *
  * @param cumMap A reference to the cumulative energy map (cv::Mat) where the seam will be identified.
  *               This map is modified internally as part of the seam-finding process.
  * @return std::vector<int> A vector representing the horizontal seam, where each element indicates the row index of the seam at a specific column.
@@ -224,13 +552,52 @@ std::vector<int> FindHorizontalSeamDP(cv::Mat &cumMap);
 std::vector<int> FindHorizontalSeamGraphCut(cv::Mat const& energyMap);
 
 
+/**
+ * @brief Sums the energy of the pixels on a horizontal seam.
+ *
+ * @param energyMap The energy map the seam was found on (CV_64F).
+ * @param seam The row index of the seam at every column.
+ * @return double The total energy of the seam.
+ */
+double SumHorizontalSeam(const cv::Mat &energyMap, std::vector<int> const &seam);
+
+
+/**
+ * @brief Sums the current energy of the pixels on a horizontal seam, without needing an up to date energy map.
+ *
+ * @param img The image the seam will be removed from.
+ * @param seam The row index of the seam at every column.
+ * @return double The total energy of the seam, as SumHorizontalSeam would give on a freshly calculated energy map.
+ */
+double CalculateHorizontalSeamEnergy(const cv::Mat &img, std::vector<int> const &seam);
+
+
+/**
+ * @brief Removes a horizontal seam from every plane in one pass, one thread per block of columns.
+ *
+ * @param planes Images or maps of the same size and any type, null pointers are skipped.
+ * @param seam The row index of the seam at a specific column.
+ */
+void RemoveHorizontalSeamFromPlanes(std::vector<cv::Mat *> const &planes, std::vector<int> const &seam);
+
+
 /**
  * @brief Removes a horizontal seam from an image.
  *
  * @param img A reference to the image (cv::Mat) from which the seam will be removed.
  * @param seam A constant reference to a vector representing the horizontal seam to remove. Each element indicates the row index of the seam at a specific column.
+ * @param planes Auxiliary planes of the same size, such as the energy map, compacted in the same pass. Null pointers are skipped.
  */
-void RemoveHorizontalSeam(cv::Mat &img, std::vector<int> const &seam);
+void RemoveHorizontalSeam(cv::Mat &img, std::vector<int> const &seam, std::vector<cv::Mat *> const &planes = {});
+
+
+/**
+ * @brief Removes a horizontal seam from a single channel CV_64F map, such as an energy map that is reused between seams.
+ *
+ * @param map A reference to the map from which the seam will be removed.
+ * @param seam The row index of the seam at every column.
+ */
+void RemoveHorizontalSeamFromMap(cv::Mat &map, std::vector<int> const &seam);
 
 
 /**
@@ -238,8 +605,9 @@ void RemoveHorizontalSeam(cv::Mat &img, std::vector<int> const &seam);
  *
  * @param img A reference to the input image (cv::Mat) to be resized.
  * @param targetHeight The desired height of the image after seam carving.
+ * @param stats Optional statistics of the removed seams.
  */
-void HorizontalSeamCarvingGreedy(cv::Mat &img, int targetHeight);
+void HorizontalSeamCarvingGreedy(cv::Mat &img, int targetHeight, CarveStats *stats = nullptr);
 
 
 /**
@@ -247,8 +615,14 @@ void HorizontalSeamCarvingGreedy(cv::Mat &img, int targetHeight);
  *
  * @param img A reference to the input image (cv::Mat) to be resized.
  * @param targetHeight The desired height of the image after seam carving.
+ * @param stats Optional statistics of the removed seams, staleEnergy against removedEnergy shows how far a stale energy map drifted.
+ * @param refreshInterval The energy map is recalculated every this many seams and only shrunk in between, 1 recalculates it for every seam.
+ * @param biasMap Optional bias in units of the unnormalised energy, see VerticalSeamCarvingDP, shrunk along with the image.
+ * @param roi Optional region of interest the seams are confined to, see GetSeamBand. The energy and cumulative maps
+ *            only cover its rows.
  */
-void HorizontalSeamCarvingDP(cv::Mat &img, int targetHeight);
+void HorizontalSeamCarvingDP(cv::Mat &img, int targetHeight, CarveStats *stats = nullptr, int refreshInterval = 1, cv::Mat *biasMap = nullptr,
+	const cv::Rect &roi = cv::Rect());
 
 
 /**
@@ -256,8 +630,433 @@ void HorizontalSeamCarvingDP(cv::Mat &img, int targetHeight);
  *
  * @param img A reference to the input image (cv::Mat) to be resized.
  * @param targetHeight The desired height of the image after seam carving.
+ * @param stats Optional statistics of the removed seams.
+ */
+void HorizontalSeamCarvingGraphCut(cv::Mat& img, int targetHeight, CarveStats *stats = nullptr);
+
+// ===============
+// DEADLINE CARVING
+// ===============
+
+/**
+ * @brief Carves an image to the target width within a time budget.
+ *
+ * Starts with exact DP and measures every seam. Whenever the remaining seams are predicted
+ * to overrun the budget, it moves to the next cheaper strategy (stale energy, a downscaled
+ * seam search and finally a plain resize of the remaining width), so it always returns by
+ * the deadline apart from the time of a single seam.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetWidth The desired width of the image after seam carving.
+ * @param budgetMs The time budget in milliseconds.
+ * @param stats Optional statistics, including the number of seams each strategy removed.
+ */
+void VerticalSeamCarvingDeadline(cv::Mat &img, int targetWidth, double budgetMs, CarveStats *stats = nullptr);
+
+
+/**
+ * @brief Carves an image to the target height within a time budget.
+ *
+ * Runs VerticalSeamCarvingDeadline on the transposed image.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetHeight The desired height of the image after seam carving.
+ * @param budgetMs The time budget in milliseconds.
+ * @param stats Optional statistics, including the number of seams each strategy removed.
+ */
+void HorizontalSeamCarvingDeadline(cv::Mat &img, int targetHeight, double budgetMs, CarveStats *stats = nullptr);
+
+
+/**
+ * @brief Describes the strategies a deadline bounded carve used, such as "Exact DP 40, Plain resize 12".
+ *
+ * @param stats The statistics filled by the deadline drivers.
+ * @return std::string The name and seam count of every strategy that removed a seam, or "none".
+ */
+std::string DescribeStrategies(const CarveStats &stats);
+
+// ===============
+// PYRAMID CARVING
+// ===============
+
+/**
+ * @brief Calculates the energy of a single pixel of an 8 bit image.
+ *
+ * Gives the same value as CalculateEnergyMap at that pixel (3x3 Sobel, reflected border),
+ * so an energy map can be patched after a seam is removed instead of being recomputed.
+ *
+ * @param img The 8 bit image, with any number of channels.
+ * @param row The row of the pixel.
+ * @param col The column of the pixel.
+ * @return double The sum of the absolute x and y gradients over every channel.
+ */
+double CalculatePixelEnergy(const cv::Mat &img, int row, int col);
+
+
+/**
+ * @brief Recalculates the energy of the pixels next to a vertical seam that was just removed.
+ *
+ * @param img The image after the seam was removed.
+ * @param energyMap The energy map after the same seam was removed with RemoveVerticalSeamFromMap.
+ * @param seam The removed seam.
+ */
+void UpdateVerticalEnergyMap(const cv::Mat &img, cv::Mat &energyMap, std::vector<int> const &seam);
+
+/**
+ * @brief Recalculates the energy of the pixels next to a horizontal seam that was just removed.
+ *
+ * @param img The image after the seam was removed.
+ * @param energyMap The energy map after the same seam was removed with RemoveHorizontalSeamFromMap.
+ * @param seam The removed seam.
+ */
+void UpdateHorizontalEnergyMap(const cv::Mat &img, cv::Mat &energyMap, std::vector<int> const &seam);
+
+
+/**
+ * @brief Finds the lowest energy vertical seam that stays within a corridor around a path.
+ *
+ * Runs the same dynamic programming as CalculateVerticalCumMap and FindVerticalSeamDP,
+ * but only over the pixels at most radius columns away from the path.
+ *
+ * @param energyMap The full resolution energy map.
+ * @param path The column of the centre of the corridor at every row.
+ * @param radius The half width of the corridor in pixels.
+ * @return std::vector<int> The column index of the seam at every row.
+ */
+std::vector<int> FindVerticalSeamInCorridor(const cv::Mat &energyMap, std::vector<int> const &path, int radius);
+
+
+/**
+ * @brief Performs vertical seam carving by finding every seam on a downscaled image and refining it at full resolution.
+ *
+ * The seam is found with dynamic programming on an image downscaled by 2^levels and then refined with a
+ * dynamic programming pass over a narrow corridor around the upsampled seam. Both the downscaled and the
+ * full resolution energy maps are only patched around the removed seams instead of being recalculated,
+ * a downscaled seam is removed once 2^levels full resolution seams have been taken from around it.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetWidth The desired width of the image after seam carving.
+ * @param levels The number of pyramid levels, 1 for half and 2 for quarter resolution.
+ * @param corridor The extra half width of the refinement corridor in full resolution pixels.
+ * @param stats Optional statistics about the removed seams.
+ */
+void VerticalSeamCarvingPyramid(cv::Mat &img, int targetWidth, int levels = 2, int corridor = 4, CarveStats *stats = nullptr);
+
+
+/**
+ * @brief Performs horizontal seam carving by finding every seam on a downscaled image and refining it at full resolution.
+ *
+ * Runs VerticalSeamCarvingPyramid on the transposed image.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetHeight The desired height of the image after seam carving.
+ * @param levels The number of pyramid levels, 1 for half and 2 for quarter resolution.
+ * @param corridor The extra half width of the refinement corridor in full resolution pixels.
+ * @param stats Optional statistics about the removed seams.
+ */
+void HorizontalSeamCarvingPyramid(cv::Mat &img, int targetHeight, int levels = 2, int corridor = 4, CarveStats *stats = nullptr);
+
+// ===============
+// MULTI SEAM CARVING
+// ===============
+
+/**
+ * @brief Finds several vertical seams that do not share a pixel from a single dynamic programming pass.
+ *
+ * The image is split into vertical strips and the cumulative map is built in one pass without letting a
+ * path cross a strip boundary, so every strip yields its own seam. Twice as many strips as seams are used
+ * and only the cheapest seams are kept, so a seam is not forced through a strip full of detail.
+ *
+ * @param energyMap The energy map of the image.
+ * @param count The number of seams wanted.
+ * @return std::vector<std::vector<int>> The seams ordered from left to right, fewer than count if the image is too narrow.
+ */
+std::vector<std::vector<int>> FindVerticalSeamsDP(const cv::Mat &energyMap, int count);
+
+
+/**
+ * @brief Removes several vertical seams that do not share a pixel from an image in one pass.
+ *
+ * @param img A reference to the image (cv::Mat) from which the seams will be removed.
+ * @param seams The seams to remove, ordered from left to right.
+ */
+void RemoveVerticalSeams(cv::Mat &img, std::vector<std::vector<int>> const &seams);
+
+
+/**
+ * @brief Performs vertical seam carving, removing up to seamsPerPass seams for every energy map and dynamic programming pass.
+ *
+ * A seamsPerPass of 1 finds the same seams as VerticalSeamCarvingDP (up to floating point ties), larger values trade quality for speed.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetWidth The desired width of the image after seam carving.
+ * @param seamsPerPass The maximum number of seams removed per pass.
+ * @param stats Optional statistics about the removed seams.
+ */
+void VerticalSeamCarvingMultiDP(cv::Mat &img, int targetWidth, int seamsPerPass, CarveStats *stats = nullptr);
+
+
+/**
+ * @brief Performs horizontal seam carving, removing up to seamsPerPass seams for every energy map and dynamic programming pass.
+ *
+ * Runs VerticalSeamCarvingMultiDP on the transposed image.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetHeight The desired height of the image after seam carving.
+ * @param seamsPerPass The maximum number of seams removed per pass.
+ * @param stats Optional statistics about the removed seams.
+ */
+void HorizontalSeamCarvingMultiDP(cv::Mat &img, int targetHeight, int seamsPerPass, CarveStats *stats = nullptr);
+
+// ===============
+// OPTIMAL ORDER
+// ===============
+
+// size the approximate transport map is filled at, about 170x120 pixels for a 3:2 image
+inline const double APPROX_ORDER_MEGAPIXELS = 0.02;
+
+// most memory the intermediate images of the exact transport map may take, about 170 vertical seams of a 2 megapixel image
+inline const double EXACT_ORDER_MAX_MEGABYTES = 1024.0;
+
+/**
+ * @brief Finds the order of vertical and horizontal seams that removes the least energy when carving to a target size.
+ *
+ * Fills the transport map of Avidan and Shamir, where cell (r, c) holds the least total energy of removing r
+ * horizontal and c vertical seams, and backtracks the cheapest path through it. Only one row of intermediate
+ * images is kept in memory, one image per vertical seam count. With a positive maxMegapixels the map is filled
+ * on a copy of the image downscaled to at most that size, with the seam counts scaled to match, and the resulting
+ * order is stretched back to the full number of seams. When the images of the exact map would take more than
+ * EXACT_ORDER_MAX_MEGABYTES it is filled on the largest downscaled copy that fits instead.
+ *
+ * @param img The image to be carved.
+ * @param targetWidth The desired width of the image.
+ * @param targetHeight The desired height of the image.
+ * @param maxMegapixels The largest image the transport map is filled on, 0 for the exact map on the full image
+ *                      as long as it fits EXACT_ORDER_MAX_MEGABYTES.
+ * @return std::vector<bool> One element per seam to remove, true for a vertical seam and false for a horizontal seam.
+ */
+std::vector<bool> FindSeamOrder(const cv::Mat &img, int targetWidth, int targetHeight, double maxMegapixels = 0.0);
+
+
+/**
+ * @brief Carves an image to a target width and height, removing the seams in the order found by FindSeamOrder.
+ *
+ * @param img A reference to the input image (cv::Mat) to be resized.
+ * @param targetWidth The desired width of the image after seam carving.
+ * @param targetHeight The desired height of the image after seam carving.
+ * @param maxMegapixels The largest image the transport map is filled on, 0 for the exact map on the full image.
+ * @param stats Optional statistics of the removed seams.
+ */
+void SeamCarvingOptimalOrder(cv::Mat &img, int targetWidth, int targetHeight, double maxMegapixels = 0.0, CarveStats *stats = nullptr);
+
+// ===============
+// BIDIRECTIONAL DP
+// ===============
+
+inline bool isBidirectional = false; // whether the DP carvers without a bias map search every seam from both ends of the image at once
+
+/**
+ * @brief Finds the same vertical seam as FindVerticalSeamDP on CalculateVerticalCumMap, filling the map from both ends at once.
+ *
+ * The bottom half of the cumulative map is filled from the last row up and the top half from the first row down,
+ * on two threads, and the seam is joined at the middle row. Both tables are plain sums of the unnormalised energy,
+ * which are exact as long as the energy holds integers like CalculateEnergyMap does, so the halves agree to the last
+ * bit on which seams are cheapest. Ties are settled like the serial walk: the leftmost cheapest column of the first
+ * row, then the middle, left and right step in that order among the steps that stay on a cheapest seam.
+ *
+ * @param energyMap The energy map before normalisation.
+ * @return std::vector<int> The column of the seam in every row.
+ */
+std::vector<int> FindVerticalSeamBidirectional(const cv::Mat &energyMap);
+
+// ===============
+// SEAM INSERTION
+// ===============
+
+/**
+ * @brief Finds the vertical seams to duplicate when enlarging an image.
+ *
+ * Removes count seams from a copy of the image with dynamic programming, as Avidan and Shamir do, and maps
+ * every removed seam back to the columns of the original image. Inserting the lowest energy seam count times
+ * would only stretch it, removing them first spreads the insertions over the next best seams.
+ *
+ * @param img The image to be enlarged.
+ * @param count The number of seams, less than the width of the image.
+ * @param stats Optional statistics, removedEnergy holds the energy of the seams that will be duplicated.
+ * @param energyMap Optional energy map of img that is already known, it is calculated when empty.
+ * @return std::vector<std::vector<int>> The seams in the columns of the original image, which never share a pixel.
+ */
+std::vector<std::vector<int>> FindVerticalSeamsForInsertion(const cv::Mat &img, int count, CarveStats *stats = nullptr, const cv::Mat &energyMap = cv::Mat());
+
+
+/**
+ * @brief Inserts several vertical seams into an image in a single pass.
+ *
+ * Every seam pixel is followed by a new pixel with the average colour of it and its right neighbour.
+ *
+ * @param img A reference to the image (cv::Mat) to enlarge.
+ * @param seams The seams to insert in the columns of the image, no two seams may share a pixel.
+ */
+void InsertVerticalSeams(cv::Mat &img, std::vector<std::vector<int>> const &seams);
+
+
+/**
+ * @brief Enlarges an image to the target width by inserting seams.
+ *
+ * Seams are inserted in batches of at most half the current width, larger batches would duplicate
+ * every column and the result would look like a plain resize.
+ *
+ * @param img A reference to the input image (cv::Mat) to be enlarged.
+ * @param targetWidth The desired width of the image after seam insertion.
+ * @param stats Optional statistics of the inserted seams.
+ * @param energyMap Optional energy map of img that is already known, used by the first batch.
+ */
+void VerticalSeamInsertion(cv::Mat &img, int targetWidth, CarveStats *stats = nullptr, const cv::Mat &energyMap = cv::Mat());
+
+
+/**
+ * @brief Enlarges an image to the target height by inserting seams.
+ *
+ * Runs VerticalSeamInsertion on the transposed image.
+ *
+ * @param img A reference to the input image (cv::Mat) to be enlarged.
+ * @param targetHeight The desired height of the image after seam insertion.
+ * @param stats Optional statistics of the inserted seams.
+ * @param energyMap Optional energy map of img that is already known, used by the first batch.
+ */
+void HorizontalSeamInsertion(cv::Mat &img, int targetHeight, CarveStats *stats = nullptr, const cv::Mat &energyMap = cv::Mat());
+
+// ===============
+// REFERENCE BACKEND
+// ===============
+
+/**
+ * @brief A kernel output that differed from the reference backend.
+ */
+struct Divergence
+{
+	std::string kernel;      // the kernel whose output differed
+	int seam = -1;           // index of the seam within the carve
+	int row = -1, col = -1;  // first differing element in row major order, or the pixel the optimised seam took, -1 when the sizes differ
+	double optimised = 0.0;  // the value of the optimised kernel, or its width (seam length) when the sizes differ
+	double reference = 0.0;  // the value of the reference kernel, or its width (seam length) when the sizes differ
+};
+
+// relative difference of two map values above which they diverge, the optimised kernels may sum in another order
+inline const double VALIDATION_TOLERANCE = 1e-9;
+
+inline bool isValidating = false;                 // the DP drivers and incremental energy updates check every seam against the reference backend
+inline std::optional<Divergence> firstDivergence; // the first divergence since it was last reset, only that one is printed
+
+/**
+ * @brief Calculates the energy map with a plain Sobel per channel, the reference for CalculateEnergyMap.
+ *
+ * @param img The 8 bit image.
+ */
+cv::Mat ReferenceEnergyMap(const cv::Mat &img);
+
+/**
+ * @brief Calculates the vertical cumulative map one element at a time, the reference for CalculateVerticalCumMap
+ *        and CalculateVerticalCumMapTiled.
+ *
+ * @param energyMap The energy map (CV_64F).
+ * @param biasMap The bias added to every pixel, empty for none.
+ */
+cv::Mat ReferenceVerticalCumMap(const cv::Mat &energyMap, const cv::Mat &biasMap = cv::Mat());
+
+/**
+ * @brief Traces the vertical seam of a cumulative map with the tie breaking of FindVerticalSeamDP.
+ *
+ * @param cumMap The cumulative map, only read.
+ */
+std::vector<int> ReferenceVerticalSeam(const cv::Mat &cumMap);
+
+/**
+ * @brief Finds the seams of one multi seam pass strip by strip, the reference for FindVerticalSeamsDP.
+ *
+ * @param energyMap The energy map (CV_64F).
+ * @param count The number of seams asked for, which decides the strips.
+ */
+std::vector<std::vector<int>> ReferenceVerticalSeams(const cv::Mat &energyMap, int count);
+
+/**
+ * @brief Copies an image without the pixels of a seam into a new allocation, the reference for the removal kernels.
+ *
+ * @param img The image or map of any type.
+ * @param seam The column of the seam on every row for a vertical seam, or the row on every column for a horizontal one.
+ * @param isVertical Whether the seam is vertical, a horizontal seam is removed from the transposed image.
+ */
+cv::Mat ReferenceRemoveSeam(const cv::Mat &img, std::vector<int> const &seam, bool isVertical);
+
+/**
+ * @brief Checks the energy map, cumulative map and seam of one DP seam against the reference backend.
+ *
+ * Every reference kernel is given the same input as the optimised one, so a divergence points at a single kernel.
+ * Horizontal seams run the vertical reference kernels on the transposed maps. The first divergence is kept in
+ * firstDivergence and printed.
+ *
+ * @param img The image, or ROI band, the seam was found on.
+ * @param energyMap The energy map calculated for this seam, empty when a stale one was reused.
+ * @param normEnergyMap The energy the cumulative map was built from, normalised unless a bias was added.
+ * @param biasMap The bias added inside the cumulative map, empty for none.
+ * @param cumMap The cumulative map of the optimised kernel.
+ * @param seam The seam the optimised kernel traced through cumMap.
+ * @param seamIndex The index of the seam within the carve.
+ * @param isVertical Whether the seam is vertical.
+ * @return true If every kernel matched the reference.
+ */
+bool ValidateSeamKernels(const cv::Mat &img, const cv::Mat &energyMap, const cv::Mat &normEnergyMap, const cv::Mat &biasMap,
+	const cv::Mat &cumMap, std::vector<int> const &seam, int seamIndex, bool isVertical);
+
+/**
+ * @brief Checks the energy map and seam of one bidirectional seam against the serial DP search.
+ *
+ * @param img The image, or ROI band, the seam was found on.
+ * @param energyMap The energy map calculated for this seam, empty when a stale one was reused.
+ * @param rawEnergyMap The unnormalised energy the seam was found on.
+ * @param seam The seam FindVerticalSeamBidirectional found, on the transposed map for a horizontal seam.
+ * @param seamIndex The index of the seam within the carve.
+ * @param isVertical Whether the seam is vertical.
+ * @return true If the seam matched FindVerticalSeamDP on CalculateVerticalCumMap.
+ */
+bool ValidateBidirectionalSeam(const cv::Mat &img, const cv::Mat &energyMap, const cv::Mat &rawEnergyMap, std::vector<int> const &seam,
+	int seamIndex, bool isVertical);
+
+/**
+ * @brief Checks an image a seam was removed from against the reference removal of the same seam.
+ *
+ * @param expected The result of ReferenceRemoveSeam on the image before the removal.
+ * @param carved The image after the optimised removal.
+ * @param seamIndex The index of the seam within the carve.
+ * @return true If the images are identical.
+ */
+bool ValidateSeamRemoval(const cv::Mat &expected, const cv::Mat &carved, int seamIndex);
+
+/**
+ * @brief Checks the seams of one multi seam pass against the reference backend.
+ *
+ * @param energyMap The energy map the seams were found on.
+ * @param count The number of seams FindVerticalSeamsDP was asked for.
+ * @param seams The seams it found.
+ * @param seamIndex The index of the first seam of the pass within the carve.
+ * @return true If every seam matched the reference.
+ */
+bool ValidateSeamBatch(const cv::Mat &energyMap, int count, std::vector<std::vector<int>> const &seams, int seamIndex);
+
+/**
+ * @brief Checks an energy map that was updated next to a removed seam against the energy map of the carved image.
+ *
+ * The recalculated pixels are checked with CalculatePixelEnergy first, then the whole map, which also catches
+ * pixels next to the seam that were left out of the update.
+ *
+ * @param img The image, or ROI band, after the seam was removed.
+ * @param energyMap The map after UpdateVerticalEnergyMap or UpdateHorizontalEnergyMap.
+ * @param seam The removed seam.
+ * @param seamIndex The index of the seam within the carve.
+ * @param isVertical Whether the seam is vertical.
+ * @return true If the map matched the reference.
  */
-void HorizontalSeamCarvingGraphCut(cv::Mat& img, int targetHeight);
+bool ValidateEnergyUpdate(const cv::Mat &img, const cv::Mat &energyMap, std::vector<int> const &seam, int seamIndex, bool isVertical);
 
 // ===============
 // VISUALIZATION
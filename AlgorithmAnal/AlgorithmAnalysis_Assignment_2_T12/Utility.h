@@ -33,6 +33,9 @@ constexpr double MAX = std::numeric_limits<double>::max(); // MAX was 255
 inline float min = 2000.f;
 inline int threshold = 8;
 inline cv::Mat brushMask;
+inline cv::Mat protectMask; // painted with the brush while isProtecting is set, seams avoid it
+inline bool isProtecting = false;
+inline float protection = 50000.f; // energy added to every protected pixel, unnormalised like the Sobel energy of up to 6120 per pixel
 inline bool isDrawing = false;
 inline int brushSize = 5;
 inline bool maskInitialized = false;
@@ -40,6 +43,7 @@ inline float resolution = 1.f; // height/width or rows/cols of image (ie for lan
 inline int rows = 0, cols = 0;
 inline cv::Mat imgClone, originalImg, energyMap, displayEnergyMap, allSeams;
 inline int waitFor = 1;
+inline bool isHeadless = false; // no windows are created, set when running the benchmarks
 
 // global constants
 inline const std::string ORIGINAL_IMAGE = "Original Image";
@@ -81,11 +85,18 @@ namespace util
 			ShowWindow(hwnd, shldShow ? SW_SHOW : SW_HIDE);
 	}
 
-	struct Mask
+	// a run of masked pixels along a row or column
+	struct Span
 	{
 		int start = 0;
 		int size = 0;
-		int pos = 0;
+	};
+
+	// masked pixels as runs sorted by start, on every row and on every column
+	struct SpanMask
+	{
+		std::vector<std::vector<Span>> rows;
+		std::vector<std::vector<Span>> cols;
 	};
 
 	inline void BeginProfile()
@@ -95,6 +106,9 @@ namespace util
 
 	inline void EndProfile(const std::string &label)
 	{
+		if (isHeadless)
+			return;
+
 		double elapsed = std::chrono::duration<double, std::milli>(NOW - start).count();
 		std::cout << label << ": " << elapsed << " ms \n";
 	}
@@ -1,6 +1,7 @@
 #pragma once
 #include "WinManager.h"
 #include "Editor.h"
+#include "SeamCarving.h"
 
 extern edit::Editor editor;
 
@@ -22,6 +23,9 @@ void WinManager::UpdateOIWin(bool toggle, cv::Mat& img)
 			//cv::setWindowProperty(ORIGINAL_IMAGE, cv::WND_PROP_AUTOSIZE, cv::WINDOW_NORMAL);
 
 			brushMask = cv::Mat::zeros(img.size(), CV_8UC1);
+			protectMask = cv::Mat::zeros(img.size(), CV_8UC1);
+			brushSpans = util::SpanMask();
+			resetBrushOverlay();
 			maskInitialized = true;
 
 			// set mouse callback (to display the mouse coordinates as will as the respective RGB values of selected pixel)